@@ -19,20 +19,15 @@
  */
 
 /*
- * Arc4 random number generator for OpenBSD.
+ * ChaCha based random number generator, derived from the OpenBSD
+ * arc4random(3) interface.
  *
- * This code is derived from section 17.1 of Applied Cryptography,
- * second edition, which describes a stream cipher allegedly
- * compatible with RSA Labs "RC4" cipher (the actual description of
- * which is a trade secret).  The same algorithm is used as a stream
- * cipher called "arcfour" in Tatu Ylonen's ssh package.
- *
- * Here the stream cipher has been modified always to include the time
- * when initializing the state.  That makes it impossible to
- * regenerate the same random sequence twice, so this can't be used
- * for encryption, but will generate good random numbers.
- *
- * RC4 is a registered trademark of RSA Laboratories.
+ * The original version used the RC4 stream cipher.  It has been
+ * replaced with ChaCha20, run in counter mode to fill a buffer of
+ * keystream several blocks at a time (see chacha_private.h).
+ * Requests are served from the buffer and, after each refill, the
+ * key is replaced with fresh keystream so that past output cannot
+ * be recovered from the state.
  */
 
 #include "config.h"
@@ -69,6 +64,20 @@
 #if defined(TIME_WITH_SYS_TIME) || !defined(HAVE_SYS_TIME_H)
 # include <time.h>
 #endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#ifdef HAVE_GETRANDOM
+# include <sys/random.h>
+#endif
+#ifdef HAVE_GETAUXVAL
+# include <sys/auxv.h>
+#endif
 
 #include <extern.h>
 
@@ -78,50 +87,144 @@
 #define inline
 #endif				/* !__GNUC__ */
 
-#define _ARC4_LOCK()
-#define _ARC4_UNLOCK()
+/*
+ * When threads are in use, give each thread its own independently
+ * seeded stream if the compiler supports thread-local storage,
+ * otherwise serialize access to a single stream.
+ */
+#if defined(HAVE_PTHREAD) && defined(HAVE___THREAD)
+# define _ARC4_TLS	__thread
+#else
+# define _ARC4_TLS
+#endif
+#if defined(HAVE_PTHREAD) && !defined(HAVE___THREAD)
+static pthread_mutex_t arc4_mtx = PTHREAD_MUTEX_INITIALIZER;
+# define _ARC4_LOCK()	pthread_mutex_lock(&arc4_mtx)
+# define _ARC4_UNLOCK()	pthread_mutex_unlock(&arc4_mtx)
+#else
+# define _ARC4_LOCK()
+# define _ARC4_UNLOCK()
+#endif
+
+/*
+ * Per-thread streams still share the process-wide AT_RANDOM seed,
+ * which must only be used once.
+ */
+#if defined(HAVE_PTHREAD) && defined(HAVE___THREAD)
+static pthread_mutex_t arc4_seed_mtx = PTHREAD_MUTEX_INITIALIZER;
+# define _ARC4_SEED_LOCK()	pthread_mutex_lock(&arc4_seed_mtx)
+# define _ARC4_SEED_UNLOCK()	pthread_mutex_unlock(&arc4_seed_mtx)
+#else
+# define _ARC4_SEED_LOCK()
+# define _ARC4_SEED_UNLOCK()
+#endif
 
 #ifndef HAVE_ARC4RANDOM
-struct arc4_stream {
-	unsigned char i;
-	unsigned char j;
-	unsigned char s[256];
-};
+#include "chacha_private.h"
+
+#define KEYSZ	CHACHA_KEYSZ
+#define IVSZ	CHACHA_IVSZ
+#define RSBUFSZ	(16 * CHACHA_BLOCKSZ)
 
-static int rs_initialized;
-static struct arc4_stream rs;
-static int arc4_count;
+static _ARC4_TLS int rs_initialized;
+static _ARC4_TLS chacha_ctx rs;		/* chacha context */
+static _ARC4_TLS size_t rs_have;		/* keystream left in rs_buf */
+static _ARC4_TLS size_t rs_count;		/* bytes till reseed */
+static _ARC4_TLS unsigned char rs_buf[RSBUFSZ];	/* keystream blocks */
 
-static inline unsigned char arc4_getbyte __P((void));
+static void arc4_stir __P((void));
+
+/* Times any stream has been (re)seeded, for mktemp -s. */
+unsigned long arc4_reseeds;
 
 static inline void
-arc4_init()
+_rs_init(buf, n)
+	unsigned char *buf;
+	size_t n;
+{
+	if (n < KEYSZ + IVSZ)
+		return;
+	chacha_keysetup(&rs, buf);
+	chacha_ivsetup(&rs, buf + KEYSZ);
+}
+
+/*
+ * Refill rs_buf, mixing in dat (if any), and immediately use the
+ * start of the new keystream as the next key.
+ */
+static void
+_rs_rekey(dat, datlen)
+	unsigned char *dat;
+	size_t datlen;
 {
-	int     n;
+	size_t i;
+
+	chacha_keystream(&rs, rs_buf, sizeof(rs_buf) / CHACHA_BLOCKSZ);
+	if (dat != NULL) {
+		if (datlen > KEYSZ + IVSZ)
+			datlen = KEYSZ + IVSZ;
+		for (i = 0; i < datlen; i++)
+			rs_buf[i] ^= dat[i];
+	}
+	_rs_init(rs_buf, KEYSZ + IVSZ);
+	memset(rs_buf, 0, KEYSZ + IVSZ);
+	rs_have = sizeof(rs_buf) - KEYSZ - IVSZ;
+}
 
-	for (n = 0; n < 256; n++)
-		rs.s[n] = n;
-	rs.i = 0;
-	rs.j = 0;
+static inline void
+_rs_stir_if_needed(len)
+	size_t len;
+{
+	if (!rs_initialized || rs_count <= len)
+		arc4_stir();
+	if (rs_count <= len)
+		rs_count = 0;
+	else
+		rs_count -= len;
 }
 
+/*
+ * Copy n bytes of keystream to buf, a buffer at a time.
+ */
 static inline void
-arc4_addrandom(dat, datlen)
-	unsigned char *dat;
-	int datlen;
+_rs_random_buf(_buf, n)
+	void *_buf;
+	size_t n;
 {
-	int           n;
-	unsigned char si;
-
-	rs.i--;
-	for (n = 0; n < 256; n++) {
-		rs.i = (rs.i + 1);
-		si = rs.s[rs.i];
-		rs.j = (rs.j + si + dat[n % datlen]);
-		rs.s[rs.i] = rs.s[rs.j];
-		rs.s[rs.j] = si;
+	unsigned char *buf = (unsigned char *)_buf;
+	unsigned char *keystream;
+	size_t m;
+
+	_rs_stir_if_needed(n);
+	while (n > 0) {
+		if (rs_have > 0) {
+			m = n < rs_have ? n : rs_have;
+			keystream = rs_buf + sizeof(rs_buf) - rs_have;
+			memcpy(buf, keystream, m);
+			memset(keystream, 0, m);
+			buf += m;
+			n -= m;
+			rs_have -= m;
+		}
+		if (rs_have == 0)
+			_rs_rekey(NULL, 0);
 	}
-	rs.j = rs.i;
+}
+
+static inline unsigned int
+_rs_random_u32()
+{
+	unsigned char *keystream;
+	uint32_t val;
+
+	_rs_stir_if_needed(sizeof(val));
+	if (rs_have < sizeof(val))
+		_rs_rekey(NULL, 0);
+	keystream = rs_buf + sizeof(rs_buf) - rs_have;
+	memcpy(&val, keystream, sizeof(val));
+	memset(keystream, 0, sizeof(val));
+	rs_have -= sizeof(val);
+	return (val);
 }
 
 #ifdef HAVE_PRNGD
@@ -173,16 +276,84 @@ bad:
 }
 #endif /* HAVE_PRNGD */
 
+#if defined(HAVE_GETAUXVAL) && defined(AT_RANDOM)
+/*
+ * The kernel passes each process 16 random bytes (AT_RANDOM) in its
+ * auxiliary vector.  Use them for the very first seed so a short-lived
+ * process does not need any system calls to get going.  Every later
+ * seed, including those of other threads, comes from elsewhere.
+ */
+static int
+arc4_seed_auxv(rnd, len)
+	unsigned char *rnd;
+	size_t len;
+{
+	static int used;
+	unsigned char *at;
+	struct timeval tv;
+	int claimed;
+
+	_ARC4_SEED_LOCK();
+	claimed = !used;
+	used = 1;
+	_ARC4_SEED_UNLOCK();
+	if (!claimed)
+		return (-1);
+
+	if ((at = (unsigned char *)getauxval(AT_RANDOM)) == NULL)
+		return (-1);
+	memset(rnd, 0, len);
+	memcpy(rnd, at, 16);
+
+	/* Normally serviced by the vDSO rather than a system call. */
+	gettimeofday(&tv, NULL);
+	memcpy(rnd + KEYSZ, &tv, sizeof(tv) < IVSZ ? sizeof(tv) : IVSZ);
+	return (0);
+}
+#endif /* HAVE_GETAUXVAL && AT_RANDOM */
+
+#ifdef HAVE_GETRANDOM
+static int
+arc4_seed_getrandom(rnd, len)
+	unsigned char *rnd;
+	size_t len;
+{
+	ssize_t nread;
+	size_t offset = 0;
+
+	while (offset < len) {
+		nread = getrandom(rnd + offset, len - offset, 0);
+		if (nread == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);	/* e.g. ENOSYS on an old kernel */
+		}
+		offset += nread;
+	}
+	return (0);
+}
+#endif /* HAVE_GETRANDOM */
+
 static void
 arc4_seed()
 {
 	struct timeval tv;
 	int seed[4];
+	unsigned char rnd[KEYSZ + IVSZ];
 #if defined(_PATH_RANDOM) || defined(HAVE_PRNGD)
 	ssize_t nread, offset = 0;
-	unsigned char rnd[128];
         int fd = -1;
+#endif
 
+#if defined(HAVE_GETAUXVAL) && defined(AT_RANDOM)
+	if (!rs_initialized && arc4_seed_auxv(rnd, sizeof(rnd)) == 0)
+		goto seeded;
+#endif
+#ifdef HAVE_GETRANDOM
+	if (arc4_seed_getrandom(rnd, sizeof(rnd)) == 0)
+		goto seeded;
+#endif
+#if defined(_PATH_RANDOM) || defined(HAVE_PRNGD)
 #ifdef _PATH_RANDOM
         fd = open(_PATH_RANDOM, O_RDONLY);
 #endif
@@ -198,12 +369,15 @@ arc4_seed()
 					continue; /* XXX - poll on EAGAIN */
 				break;
 			}
+			if (nread == 0)
+				break;
 			offset += nread;
 			if (offset == sizeof(rnd)) {
-				arc4_addrandom(rnd, sizeof(rnd));
-				return;
+				close(fd);
+				goto seeded;
 			}
 		}
+		close(fd);
         }
 #endif /* _PATH_RANDOM || HAVE_PRNGD */
         /* Don't have /dev/urandom, do our best... */
@@ -215,66 +389,33 @@ arc4_seed()
 	seed[2] = (tv.tv_sec % 10000) * 523;
 	seed[3] = (tv.tv_sec >> 10) * 389;
 
-	arc4_addrandom((unsigned char *)seed, sizeof(seed));
+	_rs_rekey((unsigned char *)seed, sizeof(seed));
+	return;
+
+seeded:
+	if (!rs_initialized)
+		_rs_init(rnd, sizeof(rnd));
+	else
+		_rs_rekey(rnd, sizeof(rnd));
+	memset(rnd, 0, sizeof(rnd));
 }
 
 static void
 arc4_stir()
 {
-	int     i;
-
-	if (!rs_initialized) {
-		arc4_init();
-		rs_initialized = 1;
-	}
-
+	/* Every stream is stirred before use, so the choice is made here. */
+	_ARC4_SEED_LOCK();
+	chacha_select();
+	arc4_reseeds++;
+	_ARC4_SEED_UNLOCK();
 	arc4_seed();
+	rs_initialized = 1;
 
-	/*
-	 * Discard early keystream, as per recommendations in:
-	 * http://www.wisdom.weizmann.ac.il/~itsik/RC4/Papers/Rc4_ksa.ps
-	 */
-	for (i = 0; i < 256; i++)
-		(void)arc4_getbyte();
-	arc4_count = 1600000;
-}
+	/* Invalidate rs_buf. */
+	rs_have = 0;
+	memset(rs_buf, 0, sizeof(rs_buf));
 
-static inline unsigned char
-arc4_getbyte()
-{
-	unsigned char si, sj;
-
-	rs.i = (rs.i + 1);
-	si = rs.s[rs.i];
-	rs.j = (rs.j + si);
-	sj = rs.s[rs.j];
-	rs.s[rs.i] = sj;
-	rs.s[rs.j] = si;
-	return (rs.s[(si + sj) & 0xff]);
-}
-
-unsigned char
-__arc4_getbyte()
-{
-	unsigned char val;
-
-	_ARC4_LOCK();
-	if (--arc4_count == 0 || !rs_initialized)
-		arc4_stir();
-	val = arc4_getbyte();
-	_ARC4_UNLOCK();
-	return val;
-}
-
-static inline unsigned int
-arc4_getword()
-{
-	unsigned int val;
-	val = arc4_getbyte() << 24;
-	val |= arc4_getbyte() << 16;
-	val |= arc4_getbyte() << 8;
-	val |= arc4_getbyte();
-	return val;
+	rs_count = 1600000;
 }
 
 void
@@ -290,10 +431,17 @@ arc4random_addrandom(dat, datlen)
 	unsigned char *dat;
 	int datlen;
 {
+	size_t m;
+
 	_ARC4_LOCK();
 	if (!rs_initialized)
 		arc4_stir();
-	arc4_addrandom(dat, datlen);
+	while (datlen > 0) {
+		m = datlen < KEYSZ + IVSZ ? datlen : KEYSZ + IVSZ;
+		_rs_rekey(dat, m);
+		dat += m;
+		datlen -= m;
+	}
 	_ARC4_UNLOCK();
 }
 
@@ -301,11 +449,9 @@ unsigned int
 arc4random()
 {
 	unsigned int val;
+
 	_ARC4_LOCK();
-	arc4_count -= 4;
-	if (arc4_count <= 0 || !rs_initialized)
-		arc4_stir();
-	val = arc4_getword();
+	val = _rs_random_u32();
 	_ARC4_UNLOCK();
 	return val;
 }
@@ -315,15 +461,8 @@ arc4random_buf(_buf, n)
 	void *_buf;
 	size_t n;
 {
-	unsigned char *buf = (unsigned char *)_buf;
 	_ARC4_LOCK();
-	if (!rs_initialized)
-		arc4_stir();
-	while (n--) {
-		if (--arc4_count <= 0)
-			arc4_stir();
-		buf[n] = arc4_getbyte();
-	}
+	_rs_random_buf(_buf, n);
 	_ARC4_UNLOCK();
 }
 #endif /* HAVE_ARC4RANDOM */
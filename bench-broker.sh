@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# Compare requests per second served by a mktemp -D broker with
+# running mktemp itself for every temporary file.
+#
+# Usage: bench-broker.sh [-c clients] [-j jobs] [-n count] [-p mktemp] [dir]
+#
+# Three cases are timed, each creating count files in dir:
+#   cli     one mktemp process per file
+#   client  one mktemp -C process per file, clients running in parallel
+#   stream  a single mktemp -C -n count
+# Requires a date(1) that supports %N.
+#
+
+MKTEMP=./mktemp
+COUNT=2000
+CLIENTS=4
+JOBS=`getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1`
+
+while getopts c:j:n:p: ch; do
+    case $ch in
+	c)  CLIENTS=$OPTARG;;
+	j)  JOBS=$OPTARG;;
+	n)  COUNT=$OPTARG;;
+	p)  MKTEMP=$OPTARG;;
+	*)  echo "usage: $0 [-c clients] [-j jobs] [-n count] [-p mktemp]" \
+		"[dir]" 1>&2
+	    exit 1;;
+    esac
+done
+shift `expr $OPTIND - 1`
+DIR=${1:-${TMPDIR:-/tmp}}
+
+now() {
+    date +%s%N
+}
+
+report() {
+    awk -v what="$1" -v ns="$2" -v n=$COUNT 'BEGIN {
+	s = ns / 1e9
+	printf "%-8s %10.3f %12.0f\n", what, s, n / s
+    }'
+}
+
+# Run "$@" COUNT times, split across CLIENTS shells.
+repeat() {
+    per=`expr $COUNT / $CLIENTS`
+    c=0
+    pids=
+    while [ $c -lt $CLIENTS ]; do
+	(i=0; while [ $i -lt $per ]; do "$@" >/dev/null || exit 1
+	    i=`expr $i + 1`; done) &
+	pids="$pids $!"
+	c=`expr $c + 1`
+    done
+    wait $pids
+}
+
+work=`$MKTEMP -d -p "$DIR" bench.XXXXXXXXXX` || exit 1
+sock="$work/broker.sock"
+trap 'kill $pid 2>/dev/null; rm -rf "$work"' 0 1 2 15
+
+$MKTEMP -D "$sock" -j $JOBS -p "$work" || exit 1 &
+pid=$!
+while [ ! -S "$sock" ]; do
+    sleep 1
+done
+
+echo "# $COUNT files in $DIR, $CLIENTS clients, broker with $JOBS jobs"
+printf "%-8s %10s %12s\n" mode seconds "requests/sec"
+
+start=`now`
+repeat $MKTEMP -p "$work"
+end=`now`
+report cli `expr $end - $start`
+
+start=`now`
+repeat $MKTEMP -C "$sock"
+end=`now`
+report client `expr $end - $start`
+
+start=`now`
+$MKTEMP -C "$sock" -n $COUNT >/dev/null || exit 1
+end=`now`
+report stream `expr $end - $start`
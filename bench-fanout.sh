@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# Compare the cost of creating temporary files as a directory fills
+# up, with everything in one directory and with -F fan-out.
+#
+# Usage: bench-fanout.sh [-n total] [-p mktemp] [-s step] [dir]
+#
+# Files are created step at a time with a single mktemp -n, until
+# total exist in each layout; each line gives the time per file at
+# that population.  Requires a date(1) that supports %N.
+#
+
+MKTEMP=./mktemp
+TOTAL=1000000
+STEP=100000
+
+while getopts n:p:s: ch; do
+    case $ch in
+	n)  TOTAL=$OPTARG;;
+	p)  MKTEMP=$OPTARG;;
+	s)  STEP=$OPTARG;;
+	*)  echo "usage: $0 [-n total] [-p mktemp] [-s step] [dir]" 1>&2
+	    exit 1;;
+    esac
+done
+shift `expr $OPTIND - 1`
+DIR=${1:-${TMPDIR:-/tmp}}
+
+work=`$MKTEMP -d -p "$DIR" bench.XXXXXXXXXX` || exit 1
+trap 'rm -rf "$work"' 0 1 2 15
+
+now() {
+    date +%s%N
+}
+
+# Time creating STEP files at a time in $1 with the remaining args.
+grow() {
+    d=$1
+    shift
+    mkdir "$d" || exit 1
+    n=0
+    while [ $n -lt $TOTAL ]; do
+	start=`now`
+	$MKTEMP -p "$d" -n $STEP "$@" >/dev/null || exit 1
+	end=`now`
+	n=$((n + STEP))
+	echo $n $((end - start))
+    done
+}
+
+echo "# $TOTAL files in $DIR, $STEP at a time, microseconds per file"
+printf "%10s %10s %10s %10s\n" files flat "-F 1" "-F 2"
+
+grow "$work/flat" > "$work/flat.out"
+rm -rf "$work/flat"
+grow "$work/f1" -F 1 > "$work/f1.out"
+rm -rf "$work/f1"
+grow "$work/f2" -F 2 > "$work/f2.out"
+rm -rf "$work/f2"
+
+paste "$work/flat.out" "$work/f1.out" "$work/f2.out" | awk -v step=$STEP '{
+    printf "%10d %10.2f %10.2f %10.2f\n", $1,
+	$2 / step / 1e3, $4 / step / 1e3, $6 / step / 1e3
+}'
@@ -0,0 +1,86 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# Compare the latency of creating a temporary file directly with
+# claiming one from a reservoir (-R) when a burst of jobs all start
+# at once.
+#
+# Usage: bench-reservoir.sh [-d] [-n jobs] [-p mktemp] [dir]
+#
+# Each job times its own mktemp invocation; the percentiles include
+# process start-up, which is the same in both cases.  Requires a
+# date(1) that supports %N.
+#
+
+MKTEMP=./mktemp
+JOBS=1000
+DFLAG=
+
+while getopts dn:p: ch; do
+    case $ch in
+	d)  DFLAG=-d;;
+	n)  JOBS=$OPTARG;;
+	p)  MKTEMP=$OPTARG;;
+	*)  echo "usage: $0 [-d] [-n jobs] [-p mktemp] [dir]" 1>&2
+	    exit 1;;
+    esac
+done
+shift `expr $OPTIND - 1`
+DIR=${1:-${TMPDIR:-/tmp}}
+
+work=`$MKTEMP -d -p "$DIR" bench.XXXXXXXXXX` || exit 1
+trap 'rm -rf "$work"' 0 1 2 15
+
+# Start JOBS copies of mktemp at once, each printing its latency in ns.
+burst() {
+    out=$1
+    shift
+    i=0
+    pids=
+    while [ $i -lt $JOBS ]; do
+	(s=`date +%s%N`; $MKTEMP $DFLAG -p "$work" "$@" >/dev/null
+	    e=`date +%s%N`; echo $((e - s))) >>"$out" &
+	pids="$pids $!"
+	i=$((i + 1))
+    done
+    wait $pids
+}
+
+report() {
+    sort -n "$2" | awk -v what="$1" '
+	{ v[NR] = $1 }
+	END {
+	    printf "%-10s %8.2f %8.2f %8.2f %8.2f\n", what,
+		v[int(NR * 0.50) + 1] / 1e6, v[int(NR * 0.90) + 1] / 1e6,
+		v[int(NR * 0.99) + 1] / 1e6, v[NR] / 1e6
+	}'
+}
+
+echo "# $JOBS concurrent jobs in $DIR${DFLAG:+ (directories)}, latency in ms"
+printf "%-10s %8s %8s %8s %8s\n" mode p50 p90 p99 max
+
+burst "$work/direct.out"
+report direct "$work/direct.out"
+
+# Stock the reservoir with enough entries for the whole burst.
+high=$((JOBS + JOBS / 10))
+$MKTEMP $DFLAG -u -R $high:$high -p "$work" >/dev/null || exit 1
+while [ `ls -A "$work"/.mktemp-reservoir.* | wc -l` -lt $high ]; do
+    sleep 1
+done
+
+burst "$work/reservoir.out" -R $((JOBS / 10)):$high
+report reservoir "$work/reservoir.out"
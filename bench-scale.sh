@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# Measure how batch creation (-n) scales with the number of worker
+# threads (-j), from one thread up to the number of CPUs.
+#
+# Usage: bench-scale.sh [-d] [-n count] [-m maxjobs] [-p mktemp] dir ...
+#
+# Each dir should be on the file system to be measured, e.g. a tmpfs
+# and an ext4 mount.  Requires a date(1) that supports %N.
+#
+
+MKTEMP=./mktemp
+COUNT=20000
+DFLAG=
+MAXJOBS=
+
+while getopts dm:n:p: ch; do
+    case $ch in
+	d)  DFLAG=-d;;
+	m)  MAXJOBS=$OPTARG;;
+	n)  COUNT=$OPTARG;;
+	p)  MKTEMP=$OPTARG;;
+	*)  echo "usage: $0 [-d] [-n count] [-m maxjobs] [-p mktemp]" \
+		"dir ..." 1>&2
+	    exit 1;;
+    esac
+done
+shift `expr $OPTIND - 1`
+if [ $# -eq 0 ]; then
+    set -- "${TMPDIR:-/tmp}"
+fi
+
+if [ -z "$MAXJOBS" ]; then
+    MAXJOBS=`getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1`
+fi
+
+now() {
+    date +%s%N
+}
+
+for dir in "$@"; do
+    fstype=`stat -f -c %T "$dir" 2>/dev/null || echo unknown`
+    echo "# $dir ($fstype), $COUNT entries${DFLAG:+ (directories)}"
+    printf "%6s %10s %12s %8s\n" jobs seconds "entries/sec" speedup
+    base=
+    jobs=1
+    while [ $jobs -le $MAXJOBS ]; do
+	work=`$MKTEMP -d -p "$dir" bench.XXXXXXXXXX` || exit 1
+	start=`now`
+	$MKTEMP $DFLAG -n $COUNT -j $jobs -p "$work" >/dev/null || exit 1
+	end=`now`
+	rm -rf "$work"
+
+	awk -v ns=`expr $end - $start` -v n=$COUNT -v j=$jobs -v base="$base" '
+	    BEGIN {
+		s = ns / 1e9; r = n / s
+		printf "%6d %10.3f %12.0f %8.2f\n", j, s, r,
+		    base ? r / base : 1
+	    }'
+	[ -z "$base" ] && base=`awk -v ns=\`expr $end - $start\` -v n=$COUNT \
+	    'BEGIN { printf "%f", n / (ns / 1e9) }'`
+	jobs=`expr $jobs + 1`
+    done
+done
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * mktemp-bench: time every single call to mkstemp() or mkdtemp(), using
+ * our engine with random names or an encrypted counter (mktemp -c), or
+ * the C library's, and print the throughput, collisions and latency
+ * percentiles of the run as one line of JSON.  bench.sh runs it over a
+ * matrix of scenarios for "make bench".
+ *
+ * Usage: mktemp-bench [-d] [-e private|counter|libc] [-n count]
+ *	      [-o occupancy] [-P procs] [-t threads] [-x xs] dir
+ *
+ * The count entries are shared between procs processes of threads
+ * threads each, all creating in dir; each process has its own counter.
+ * With -o, dir is first filled with that many entries with random
+ * names from the same template, untimed, as if by others.  Entries
+ * are left behind for the caller to remove along with dir.  The C
+ * library's functions may insist on exactly six Xs.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#ifdef HAVE_SYS_VFS_H
+# include <sys/vfs.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif /* HAVE_STRINGS_H */
+#endif /* HAVE_STRING_H */
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <extern.h>
+
+#ifndef MAP_ANONYMOUS
+# define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+#ifdef HAVE_PROGNAME
+extern char *__progname;
+#else
+char *__progname;
+#endif
+
+#define XS_MAX		64
+
+struct job {
+	unsigned long *lat;	/* latency of each creation, in ns */
+	unsigned long count;
+	int error;		/* errno of the first failure */
+	struct mktemp_ctx ctx;	/* attempts and collisions, for ours */
+	char path[PATH_MAX];
+};
+
+#define ENGINE_PRIVATE	0
+#define ENGINE_COUNTER	1
+#define ENGINE_LIBC	2
+
+static const char *engines[] = { "private", "counter", "libc", NULL };
+
+static const char *dir;
+static int makedir, engine, xs = 10;
+
+static unsigned long
+now()
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec);
+#else
+	struct timeval tv;
+
+	(void)gettimeofday(&tv, NULL);
+	return ((unsigned long)tv.tv_sec * 1000000000UL + tv.tv_usec * 1000);
+#endif
+}
+
+static void
+set_template(path, prefix)
+	char *path;
+	const char *prefix;
+{
+	int len;
+
+	len = snprintf(path, PATH_MAX, "%s/%s.", dir, prefix);
+	(void)memset(path + len, 'X', xs);
+	path[len + xs] = '\0';
+}
+
+/*
+ * Create one entry from path, which is filled in, with the C library
+ * or with our engine and the given context.
+ */
+static int
+create(path, libc, ctx)
+	char *path;
+	int libc;
+	struct mktemp_ctx *ctx;
+{
+	int fd;
+
+	if (makedir) {
+		if (libc) {
+#ifdef HAVE_MKDTEMP
+			return (mkdtemp(path) ? 0 : -1);
+#else
+			errno = ENOSYS;
+			return (-1);
+#endif
+		}
+		return (mktemp_mkdtempsat(AT_FDCWD, path, 0, S_IRWXU, ctx) ?
+		    0 : -1);
+	}
+	if (libc)
+		fd = mkstemp(path);
+	else
+		fd = mktemp_mkostempsat(AT_FDCWD, path, 0, 0, S_IRUSR|S_IWUSR,
+		    ctx);
+	if (fd == -1)
+		return (-1);
+	(void)close(fd);
+	return (0);
+}
+
+static void *
+run_job(arg)
+	void *arg;
+{
+	struct job *j = (struct job *)arg;
+	unsigned long i, start;
+
+	for (i = 0; i < j->count; i++) {
+		set_template(j->path, "tmp");
+		start = now();
+		if (create(j->path, engine == ENGINE_LIBC, &j->ctx) != 0) {
+			j->error = errno;
+			break;
+		}
+		j->lat[i] = now() - start;
+	}
+	j->count = i;
+	return (NULL);
+}
+
+/*
+ * Run the threads of one process, which share a counter.
+ */
+static void
+run_proc(jobs, nthreads)
+	struct job *jobs;
+	int nthreads;
+{
+	struct mktemp_seq *seq = NULL;
+	int i;
+#ifdef HAVE_PTHREAD
+	pthread_t *tids;
+	int n;
+#endif
+
+	if (engine == ENGINE_COUNTER && (seq = mktemp_seq_create()) == NULL) {
+		for (i = 0; i < nthreads; i++)
+			jobs[i].error = errno;
+		return;
+	}
+	for (i = 0; i < nthreads; i++)
+		jobs[i].ctx.seq = seq;
+#ifdef HAVE_PTHREAD
+
+	if (nthreads > 1 &&
+	    (tids = (pthread_t *)calloc(nthreads, sizeof(*tids))) != NULL) {
+		for (n = 1; n < nthreads; n++) {
+			if (pthread_create(&tids[n], NULL, run_job,
+			    &jobs[n]) != 0)
+				break;
+		}
+		run_job(&jobs[0]);
+		for (i = n; i < nthreads; i++)
+			run_job(&jobs[i]);
+		for (i = 1; i < n; i++)
+			(void)pthread_join(tids[i], NULL);
+		free(tids);
+	} else
+#endif
+	for (i = 0; i < nthreads; i++)
+		run_job(&jobs[i]);
+	mktemp_seq_free(seq);
+}
+
+static int
+cmp_lat(a, b)
+	const void *a;
+	const void *b;
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static double
+percentile(lat, n, p)
+	unsigned long *lat;
+	unsigned long n;
+	double p;
+{
+	unsigned long i;
+
+	if (n == 0)
+		return (0);
+	i = (unsigned long)(p * (n - 1) + 0.5);
+	return (lat[i] / 1000.0);
+}
+
+static const char *
+fstype()
+{
+#if defined(HAVE_STATFS) && defined(HAVE_SYS_VFS_H)
+	static char buf[32];
+	struct statfs sfs;
+
+	if (statfs(dir, &sfs) != 0)
+		return ("unknown");
+	switch ((unsigned long)sfs.f_type) {
+	case 0x01021994UL:
+		return ("tmpfs");
+	case 0xef53UL:
+		return ("ext4");
+	case 0x58465342UL:
+		return ("xfs");
+	case 0x9123683eUL:
+		return ("btrfs");
+	}
+	(void)snprintf(buf, sizeof(buf), "0x%lx", (unsigned long)sfs.f_type);
+	return (buf);
+#else
+	return ("unknown");
+#endif
+}
+
+static unsigned long
+getnum(str, what)
+	const char *str;
+	const char *what;
+{
+	unsigned long n;
+	char *ep;
+
+	errno = 0;
+	n = strtoul(str, &ep, 10);
+	if (*str == '\0' || *ep != '\0' || errno != 0 || n > INT_MAX) {
+		(void)fprintf(stderr, "%s: invalid %s: %s\n", __progname, what,
+		    str);
+		exit(1);
+	}
+	return (n);
+}
+
+static void
+usage()
+{
+	(void)fprintf(stderr,
+	    "usage: %s [-d] [-e private|counter|libc] [-n count]\n"
+	    "           [-o occupancy] [-P procs] [-t threads] [-x xs] dir\n",
+	    __progname);
+	exit(1);
+}
+
+int
+main(argc, argv)
+	int argc;
+	char **argv;
+{
+	struct job *jobs;
+	unsigned long count = 10000, occupancy = 0, i, n, per, total, start;
+	unsigned long attempts = 0, collisions = 0;
+	unsigned long *lat;
+	int ch, procs = 1, threads = 1, njobs, p, status, error = 0;
+	char path[PATH_MAX];
+	double secs;
+	pid_t pid;
+
+#ifndef HAVE_PROGNAME
+	__progname = argv[0];
+#endif
+
+	while ((ch = getopt(argc, argv, "de:n:o:P:t:x:")) != -1) {
+		switch (ch) {
+		case 'd':
+			makedir = 1;
+			break;
+		case 'e':
+			for (engine = 0; engines[engine] != NULL; engine++) {
+				if (strcmp(optarg, engines[engine]) == 0)
+					break;
+			}
+			if (engines[engine] == NULL)
+				usage();
+			break;
+		case 'n':
+			count = getnum(optarg, "count");
+			break;
+		case 'o':
+			occupancy = getnum(optarg, "occupancy");
+			break;
+		case 'P':
+			procs = (int)getnum(optarg, "process count");
+			break;
+		case 't':
+			threads = (int)getnum(optarg, "thread count");
+			break;
+		case 'x':
+			xs = (int)getnum(optarg, "number of Xs");
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind != 1 || procs == 0 || threads == 0 || xs == 0 ||
+	    xs > XS_MAX || count == 0)
+		usage();
+	dir = argv[optind];
+
+	/* Fill the directory first; the names can collide with ours. */
+	for (i = 0; i < occupancy; i++) {
+		set_template(path, "tmp");
+		if (create(path, 0, NULL) != 0) {
+			(void)fprintf(stderr, "%s: cannot fill %s: %s\n",
+			    __progname, dir, strerror(errno));
+			exit(1);
+		}
+	}
+
+	/* Shared with the processes, so they can hand back their times. */
+	njobs = procs * threads;
+	jobs = (struct job *)mmap(NULL, njobs * sizeof(*jobs),
+	    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	lat = (unsigned long *)mmap(NULL, count * sizeof(*lat),
+	    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (jobs == MAP_FAILED || lat == MAP_FAILED) {
+		(void)fprintf(stderr, "%s: %s\n", __progname, strerror(errno));
+		exit(1);
+	}
+	per = count / njobs;
+	for (i = 0, n = 0; i < (unsigned long)njobs; i++) {
+		jobs[i].lat = lat + n;
+		jobs[i].count = per + (i < count % njobs);
+		n += jobs[i].count;
+	}
+
+	start = now();
+	if (procs == 1)
+		run_proc(jobs, threads);
+	else {
+		for (p = 0; p < procs; p++) {
+			switch (pid = fork()) {
+			case -1:
+				(void)fprintf(stderr, "%s: fork: %s\n",
+				    __progname, strerror(errno));
+				exit(1);
+			case 0:
+				run_proc(jobs + p * threads, threads);
+				_exit(0);
+			}
+		}
+		while (wait(&status) != -1 || errno == EINTR)
+			continue;
+	}
+	secs = (now() - start) / 1e9;
+
+	/* Gather the times of the entries made, reporting one failure. */
+	for (i = 0, total = 0; i < (unsigned long)njobs; i++) {
+		if (jobs[i].error != 0 && error == 0) {
+			error = jobs[i].error;
+			(void)fprintf(stderr, "%s: cannot create %s: %s\n",
+			    __progname, jobs[i].path, strerror(error));
+		}
+		(void)memmove(lat + total, jobs[i].lat,
+		    jobs[i].count * sizeof(*lat));
+		total += jobs[i].count;
+		attempts += jobs[i].ctx.attempts;
+		collisions += jobs[i].ctx.collisions;
+	}
+	qsort(lat, total, sizeof(*lat), cmp_lat);
+
+	(void)printf("{\"engine\": \"%s\", \"kind\": \"%s\", \"fs\": \"%s\", "
+	    "\"xs\": %d, \"occupancy\": %lu, \"procs\": %d, \"threads\": %d, "
+	    "\"count\": %lu, \"created\": %lu, ", engines[engine],
+	    makedir ? "dir" : "file", fstype(), xs, occupancy, procs, threads,
+	    count, total);
+	/* The C library does not say how often it had to retry. */
+	if (engine != ENGINE_LIBC)
+		(void)printf("\"attempts\": %lu, \"collisions\": %lu, ",
+		    attempts, collisions);
+	(void)printf("\"seconds\": %.6f, \"per_sec\": %.0f, \"p50_us\": %.2f, "
+	    "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f}\n",
+	    secs, secs > 0 ? total / secs : 0, percentile(lat, total, 0.50),
+	    percentile(lat, total, 0.99), percentile(lat, total, 0.999),
+	    total ? lat[total - 1] / 1000.0 : 0);
+	exit(error != 0);
+}
@@ -0,0 +1,117 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# The benchmark suite run by "make bench": mktemp-bench over our engine,
+# with random and counter (-c) names, and the C library's, for files
+# and directories, in each dir given.  Starting from count entries with
+# ten Xs in an empty directory by a single thread, each of these is
+# varied in turn:
+#
+#	the number of Xs		(-x list)
+#	entries already present		(-o list)
+#	processes creating at once	(1 to -m maxjobs)
+#	threads creating at once	(1 to -m maxjobs)
+#
+# Our engines are also run with three Xs in a directory that already
+# has 100000 entries, so that collisions are frequent.
+#
+# Usage: bench.sh [-b mktemp-bench] [-m maxjobs] [-n count] [-o list]
+#		  [-p mktemp] [-x list] [dir ...]
+#
+# The results are written to standard output as a JSON document, one
+# object per run, so they can be compared between releases.  With no
+# dir, $TMPDIR (or /tmp) and /dev/shm are used, to compare disk with
+# tmpfs.  Each run gets a fresh directory, removed afterwards.
+#
+
+BENCH=./mktemp-bench
+MKTEMP=./mktemp
+COUNT=10000
+MAXJOBS=
+OCCUPANCY="1000 100000"
+XS="6 16"
+
+while getopts b:m:n:o:p:x: ch; do
+    case $ch in
+	b)  BENCH=$OPTARG;;
+	m)  MAXJOBS=$OPTARG;;
+	n)  COUNT=$OPTARG;;
+	o)  OCCUPANCY=$OPTARG;;
+	p)  MKTEMP=$OPTARG;;
+	x)  XS=$OPTARG;;
+	*)  echo "usage: $0 [-b mktemp-bench] [-m maxjobs] [-n count]" \
+		"[-o list] [-p mktemp] [-x list] [dir ...]" 1>&2
+	    exit 1;;
+    esac
+done
+shift `expr $OPTIND - 1`
+if [ $# -eq 0 ]; then
+    set -- "${TMPDIR:-/tmp}"
+    [ -d /dev/shm ] && set -- "$@" /dev/shm
+fi
+
+NCPU=`getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1`
+if [ -z "$MAXJOBS" ]; then
+    MAXJOBS=$NCPU
+    [ $MAXJOBS -lt 4 ] && MAXJOBS=4
+fi
+
+sep=
+# Run one scenario in a fresh directory under $dir.
+run() {
+    work=`$MKTEMP -d -p "$dir" bench.XXXXXXXXXX` || exit 1
+    result=`$BENCH "$@" "$work"`
+    status=$?
+    rm -rf "$work"
+    if [ $status -ne 0 ]; then
+	echo "$0: $BENCH $* failed" 1>&2
+	return
+    fi
+    printf '%s    %s' "$sep" "$result" |
+	sed "s|^    {|    {\"dir\": \"$dir\", |"
+    sep=",
+"
+}
+
+echo "{"
+echo "  \"date\": \"`date -u +%Y-%m-%dT%H:%M:%SZ`\","
+echo "  \"host\": \"`uname -srm`\","
+echo "  \"cpus\": $NCPU,"
+echo "  \"results\": ["
+for dir in "$@"; do
+    for engine in private counter libc; do
+	for kind in "" -d; do
+	    set -- -e $engine -n $COUNT $kind
+	    run "$@"
+	    for x in $XS; do
+		run "$@" -x $x
+	    done
+	    for o in $OCCUPANCY; do
+		run "$@" -o $o
+	    done
+	    [ $engine = libc ] || run "$@" -x 3 -o 100000
+	    jobs=2
+	    while [ $jobs -le $MAXJOBS ]; do
+		run "$@" -P $jobs
+		run "$@" -t $jobs
+		jobs=`expr $jobs \* 2`
+	    done
+	done
+    done
+done
+echo
+echo "  ]"
+echo "}"
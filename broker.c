@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Wire protocol for the mktemp -D broker.
+ *
+ * A client connects to the broker's Unix domain socket and sends
+ * requests, each asking for a number of entries.  For every entry the
+ * broker sends one reply: an error number and the name of the entry,
+ * with a descriptor for it attached as SCM_RIGHTS ancillary data.
+ * A reply with a non-zero error number ends the request and carries
+ * no descriptor.  Sequenced packets keep each reply in one piece.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_UN_H
+# include <sys/un.h>
+#endif
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif /* HAVE_STRINGS_H */
+#endif /* HAVE_STRING_H */
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <extern.h>
+
+#if defined(HAVE_SYS_UN_H) && defined(SOCK_SEQPACKET) && defined(SCM_RIGHTS)
+# define HAVE_BROKER
+#endif
+
+#ifdef HAVE_BROKER
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL	0
+#endif
+#ifndef MSG_CMSG_CLOEXEC
+# define MSG_CMSG_CLOEXEC	0
+#endif
+
+struct broker_request {
+	unsigned int count;	/* entries wanted */
+};
+
+struct broker_reply {
+	int error;		/* errno value, 0 on success */
+	unsigned int len;	/* length of the name that follows */
+};
+
+static int
+broker_addr(sockpath, sun)
+	const char *sockpath;
+	struct sockaddr_un *sun;
+{
+	(void)memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof(sun->sun_path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	(void)strcpy(sun->sun_path, sockpath); /* SAFE */
+	return (0);
+}
+
+/*
+ * Create the broker's socket, accessible to its owner only.  The umask
+ * is shared by every thread, so it is left alone: Linux gives the
+ * socket file the mode of the socket itself, elsewhere it is changed
+ * once bound.  Peers are checked on accept in any case.
+ */
+int
+mktemp_broker_listen(sockpath)
+	const char *sockpath;
+{
+	struct sockaddr_un sun;
+	int sock, serrno;
+
+	if (broker_addr(sockpath, &sun) == -1)
+		return (-1);
+	if ((sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1)
+		return (-1);
+	(void)fchmod(sock, S_IRUSR|S_IWUSR);
+	if (bind(sock, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		goto bad;
+	if (chmod(sockpath, S_IRUSR|S_IWUSR) == -1 ||
+	    listen(sock, SOMAXCONN) == -1) {
+		serrno = errno;
+		(void)unlink(sockpath);
+		errno = serrno;
+		goto bad;
+	}
+	return (sock);
+
+bad:
+	serrno = errno;
+	(void)close(sock);
+	errno = serrno;
+	return (-1);
+}
+
+/*
+ * Accept the next client on the broker's socket.  Only processes
+ * running as the broker's user, or as root, are let through; anyone
+ * else is hung up on with EPERM.
+ */
+int
+mktemp_broker_accept(lsock)
+	int lsock;
+{
+	uid_t uid;
+	int sock;
+#if defined(SO_PEERCRED)
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+#elif defined(HAVE_GETPEEREID)
+	gid_t gid;
+#endif
+
+	if ((sock = accept(lsock, NULL, NULL)) == -1)
+		return (-1);
+#if defined(SO_PEERCRED)
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+		goto gone;
+	uid = cred.uid;
+#elif defined(HAVE_GETPEEREID)
+	if (getpeereid(sock, &uid, &gid) == -1)
+		goto gone;
+#else
+	uid = geteuid();
+#endif
+	if (uid == geteuid() || uid == 0)
+		return (sock);
+	(void)close(sock);
+	errno = EPERM;
+	return (-1);
+
+#if defined(SO_PEERCRED) || defined(HAVE_GETPEEREID)
+gone:
+	/* Nothing can be said about this peer, so it is dropped. */
+	(void)close(sock);
+	errno = ECONNABORTED;
+	return (-1);
+#endif
+}
+
+int
+mktemp_broker_connect(sockpath)
+	const char *sockpath;
+{
+	struct sockaddr_un sun;
+	int sock, serrno;
+
+	if (broker_addr(sockpath, &sun) == -1)
+		return (-1);
+	if ((sock = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1)
+		return (-1);
+	if (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		serrno = errno;
+		(void)close(sock);
+		errno = serrno;
+		return (-1);
+	}
+	return (sock);
+}
+
+/*
+ * Ask for count entries; large counts are split into several requests.
+ */
+int
+mktemp_broker_request(sock, count)
+	int sock;
+	unsigned long count;
+{
+	struct broker_request req;
+	ssize_t nsent;
+
+	while (count != 0) {
+		req.count = count > UINT_MAX ? UINT_MAX : (unsigned int)count;
+		nsent = send(sock, &req, sizeof(req), MSG_NOSIGNAL);
+		if (nsent == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		count -= req.count;
+	}
+	return (0);
+}
+
+/*
+ * Wait for the next request on a client connection.  Returns the
+ * number of entries wanted, or 0 once the client has gone away.
+ */
+unsigned long
+mktemp_broker_getreq(sock)
+	int sock;
+{
+	struct broker_request req;
+	ssize_t nread;
+
+	for (;;) {
+		nread = recv(sock, &req, sizeof(req), 0);
+		if (nread == sizeof(req))
+			return (req.count);
+		if (nread == -1 && errno == EINTR)
+			continue;
+		return (0);
+	}
+}
+
+/*
+ * Send one reply.  The descriptor is only passed along when error is 0.
+ */
+int
+mktemp_broker_send(sock, fd, path, error)
+	int sock;
+	int fd;
+	const char *path;
+	int error;
+{
+	struct broker_reply reply;
+	struct msghdr msg;
+	struct iovec iov[2];
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsgbuf;
+	struct cmsghdr *cmsg;
+	ssize_t nsent;
+
+	reply.error = error;
+	reply.len = error ? 0 : strlen(path);
+	iov[0].iov_base = &reply;
+	iov[0].iov_len = sizeof(reply);
+	iov[1].iov_base = (void *)path;
+	iov[1].iov_len = reply.len;
+
+	(void)memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	if (error == 0) {
+		(void)memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+		msg.msg_control = cmsgbuf.buf;
+		msg.msg_controllen = sizeof(cmsgbuf.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		(void)memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	do {
+		nsent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	} while (nsent == -1 && errno == EINTR);
+	return (nsent == -1 ? -1 : 0);
+}
+
+/*
+ * Collect one reply, storing the entry's name in path.  Returns the
+ * descriptor passed along with it, or -1 with errno set to whatever
+ * the broker ran into.
+ */
+int
+mktemp_broker_recv(sock, path, size)
+	int sock;
+	char *path;
+	size_t size;
+{
+	struct broker_reply reply;
+	struct msghdr msg;
+	struct iovec iov[2];
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsgbuf;
+	struct cmsghdr *cmsg;
+	ssize_t nread;
+	int fd = -1;
+
+	if (size == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	iov[0].iov_base = &reply;
+	iov[0].iov_len = sizeof(reply);
+	iov[1].iov_base = path;
+	iov[1].iov_len = size - 1;
+	(void)memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+	do {
+		nread = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (nread == -1 && errno == EINTR);
+	if (nread == -1)
+		return (-1);
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			(void)memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if (nread < (ssize_t)sizeof(reply)) {
+		/* Broker went away. */
+		errno = nread == 0 ? ECONNRESET : EPROTO;
+		goto bad;
+	}
+	if (reply.error != 0) {
+		errno = reply.error;
+		goto bad;
+	}
+	if ((msg.msg_flags & MSG_TRUNC) || reply.len >= size ||
+	    (size_t)nread != sizeof(reply) + reply.len) {
+		errno = ENAMETOOLONG;
+		goto bad;
+	}
+	if (fd == -1) {
+		errno = EPROTO;
+		return (-1);
+	}
+	path[reply.len] = '\0';
+	return (fd);
+
+bad:
+	if (fd != -1)
+		(void)close(fd);
+	return (-1);
+}
+
+#else /* HAVE_BROKER */
+
+int
+mktemp_broker_listen(sockpath)
+	const char *sockpath;
+{
+	errno = EOPNOTSUPP;
+	return (-1);
+}
+
+int
+mktemp_broker_connect(sockpath)
+	const char *sockpath;
+{
+	errno = EOPNOTSUPP;
+	return (-1);
+}
+
+int
+mktemp_broker_request(sock, count)
+	int sock;
+	unsigned long count;
+{
+	errno = EOPNOTSUPP;
+	return (-1);
+}
+
+int
+mktemp_broker_accept(lsock)
+	int lsock;
+{
+	errno = EOPNOTSUPP;
+	return (-1);
+}
+
+unsigned long
+mktemp_broker_getreq(sock)
+	int sock;
+{
+	return (0);
+}
+
+int
+mktemp_broker_send(sock, fd, path, error)
+	int sock;
+	int fd;
+	const char *path;
+	int error;
+{
+	errno = EOPNOTSUPP;
+	return (-1);
+}
+
+int
+mktemp_broker_recv(sock, path, size)
+	int sock;
+	char *path;
+	size_t size;
+{
+	errno = EOPNOTSUPP;
+	return (-1);
+}
+
+#endif /* HAVE_BROKER */
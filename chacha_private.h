@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * ChaCha20 keystream generator, after D. J. Bernstein's reference
+ * implementation (64-bit nonce, 64-bit block counter).
+ *
+ * Only the keystream is needed, so there is no encrypt/decrypt entry
+ * point; chacha_keystream() fills whole 64-byte blocks.  On x86 the
+ * blocks are computed 4 (SSE2) or 8 (AVX2) at a time when the CPU
+ * supports it, otherwise one at a time in portable C.
+ */
+
+#ifndef _MKTEMP_CHACHA_PRIVATE_H
+#define _MKTEMP_CHACHA_PRIVATE_H
+
+#define CHACHA_KEYSZ	32
+#define CHACHA_IVSZ	8
+#define CHACHA_BLOCKSZ	64
+
+typedef struct {
+	uint32_t input[16];
+} chacha_ctx;
+
+#define U8TO32_LITTLE(p) \
+	(((uint32_t)((p)[0])) | ((uint32_t)((p)[1]) << 8) | \
+	 ((uint32_t)((p)[2]) << 16) | ((uint32_t)((p)[3]) << 24))
+
+#define U32TO8_LITTLE(p, v) do { \
+	(p)[0] = (unsigned char)((v)); \
+	(p)[1] = (unsigned char)((v) >> 8); \
+	(p)[2] = (unsigned char)((v) >> 16); \
+	(p)[3] = (unsigned char)((v) >> 24); \
+} while (0)
+
+#define ROTL32(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) do { \
+	a += b; d = ROTL32(d ^ a, 16); \
+	c += d; b = ROTL32(b ^ c, 12); \
+	a += b; d = ROTL32(d ^ a, 8); \
+	c += d; b = ROTL32(b ^ c, 7); \
+} while (0)
+
+static const char sigma[16] = "expand 32-byte k";
+
+static void
+chacha_keysetup(x, k)
+	chacha_ctx *x;
+	const unsigned char *k;
+{
+	x->input[0] = U8TO32_LITTLE(sigma + 0);
+	x->input[1] = U8TO32_LITTLE(sigma + 4);
+	x->input[2] = U8TO32_LITTLE(sigma + 8);
+	x->input[3] = U8TO32_LITTLE(sigma + 12);
+	x->input[4] = U8TO32_LITTLE(k + 0);
+	x->input[5] = U8TO32_LITTLE(k + 4);
+	x->input[6] = U8TO32_LITTLE(k + 8);
+	x->input[7] = U8TO32_LITTLE(k + 12);
+	x->input[8] = U8TO32_LITTLE(k + 16);
+	x->input[9] = U8TO32_LITTLE(k + 20);
+	x->input[10] = U8TO32_LITTLE(k + 24);
+	x->input[11] = U8TO32_LITTLE(k + 28);
+}
+
+static void
+chacha_ivsetup(x, iv)
+	chacha_ctx *x;
+	const unsigned char *iv;
+{
+	x->input[12] = 0;
+	x->input[13] = 0;
+	x->input[14] = U8TO32_LITTLE(iv + 0);
+	x->input[15] = U8TO32_LITTLE(iv + 4);
+}
+
+/*
+ * Advance the 64-bit block counter by n.
+ */
+#define CHACHA_ADVANCE(x, n) do { \
+	uint32_t _lo = (x)->input[12]; \
+	(x)->input[12] += (n); \
+	if ((x)->input[12] < _lo) \
+		(x)->input[13]++; \
+} while (0)
+
+/*
+ * Portable version: one block per iteration.
+ */
+static void
+chacha_blocks_ref(x, c, nblocks)
+	chacha_ctx *x;
+	unsigned char *c;
+	size_t nblocks;
+{
+	uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint32_t x8, x9, x10, x11, x12, x13, x14, x15;
+	uint32_t *j = x->input;
+	int i;
+
+	for (; nblocks != 0; nblocks--, c += CHACHA_BLOCKSZ) {
+		x0 = j[0]; x1 = j[1]; x2 = j[2]; x3 = j[3];
+		x4 = j[4]; x5 = j[5]; x6 = j[6]; x7 = j[7];
+		x8 = j[8]; x9 = j[9]; x10 = j[10]; x11 = j[11];
+		x12 = j[12]; x13 = j[13]; x14 = j[14]; x15 = j[15];
+		for (i = 20; i > 0; i -= 2) {
+			QUARTERROUND(x0, x4, x8, x12);
+			QUARTERROUND(x1, x5, x9, x13);
+			QUARTERROUND(x2, x6, x10, x14);
+			QUARTERROUND(x3, x7, x11, x15);
+			QUARTERROUND(x0, x5, x10, x15);
+			QUARTERROUND(x1, x6, x11, x12);
+			QUARTERROUND(x2, x7, x8, x13);
+			QUARTERROUND(x3, x4, x9, x14);
+		}
+		x0 += j[0]; x1 += j[1]; x2 += j[2]; x3 += j[3];
+		x4 += j[4]; x5 += j[5]; x6 += j[6]; x7 += j[7];
+		x8 += j[8]; x9 += j[9]; x10 += j[10]; x11 += j[11];
+		x12 += j[12]; x13 += j[13]; x14 += j[14]; x15 += j[15];
+		U32TO8_LITTLE(c + 0, x0);
+		U32TO8_LITTLE(c + 4, x1);
+		U32TO8_LITTLE(c + 8, x2);
+		U32TO8_LITTLE(c + 12, x3);
+		U32TO8_LITTLE(c + 16, x4);
+		U32TO8_LITTLE(c + 20, x5);
+		U32TO8_LITTLE(c + 24, x6);
+		U32TO8_LITTLE(c + 28, x7);
+		U32TO8_LITTLE(c + 32, x8);
+		U32TO8_LITTLE(c + 36, x9);
+		U32TO8_LITTLE(c + 40, x10);
+		U32TO8_LITTLE(c + 44, x11);
+		U32TO8_LITTLE(c + 48, x12);
+		U32TO8_LITTLE(c + 52, x13);
+		U32TO8_LITTLE(c + 56, x14);
+		U32TO8_LITTLE(c + 60, x15);
+		CHACHA_ADVANCE(x, 1);
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+# include <immintrin.h>
+
+/*
+ * The vector versions keep word i of N consecutive blocks in lane
+ * 0..N-1 of vector v[i], run the rounds on all of them at once and
+ * transpose back to block order when storing.
+ */
+#define VQUARTERROUND(a, b, c, d, ADD, XOR, ROT16, ROT12, ROT8, ROT7) do { \
+	a = ADD(a, b); d = ROT16(XOR(d, a)); \
+	c = ADD(c, d); b = ROT12(XOR(b, c)); \
+	a = ADD(a, b); d = ROT8(XOR(d, a)); \
+	c = ADD(c, d); b = ROT7(XOR(b, c)); \
+} while (0)
+
+#define VDOUBLEROUND(v, QR) do { \
+	QR(v[0], v[4], v[8], v[12]); \
+	QR(v[1], v[5], v[9], v[13]); \
+	QR(v[2], v[6], v[10], v[14]); \
+	QR(v[3], v[7], v[11], v[15]); \
+	QR(v[0], v[5], v[10], v[15]); \
+	QR(v[1], v[6], v[11], v[12]); \
+	QR(v[2], v[7], v[8], v[13]); \
+	QR(v[3], v[4], v[9], v[14]); \
+} while (0)
+
+#define SSE2_ROTL(v, n) \
+	_mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define SSE2_ROT16(v)	SSE2_ROTL(v, 16)
+#define SSE2_ROT12(v)	SSE2_ROTL(v, 12)
+#define SSE2_ROT8(v)	SSE2_ROTL(v, 8)
+#define SSE2_ROT7(v)	SSE2_ROTL(v, 7)
+#define SSE2_QR(a, b, c, d) VQUARTERROUND(a, b, c, d, _mm_add_epi32, \
+	_mm_xor_si128, SSE2_ROT16, SSE2_ROT12, SSE2_ROT8, SSE2_ROT7)
+
+/*
+ * 4x4 transpose of words w..w+3 of four blocks, stored to each block.
+ */
+#define SSE2_STORE4(c, v, w) do { \
+	__m128i _t0 = _mm_unpacklo_epi32(v[w], v[w + 1]); \
+	__m128i _t1 = _mm_unpacklo_epi32(v[w + 2], v[w + 3]); \
+	__m128i _t2 = _mm_unpackhi_epi32(v[w], v[w + 1]); \
+	__m128i _t3 = _mm_unpackhi_epi32(v[w + 2], v[w + 3]); \
+	_mm_storeu_si128((__m128i *)((c) + 0 * 64 + (w) * 4), \
+	    _mm_unpacklo_epi64(_t0, _t1)); \
+	_mm_storeu_si128((__m128i *)((c) + 1 * 64 + (w) * 4), \
+	    _mm_unpackhi_epi64(_t0, _t1)); \
+	_mm_storeu_si128((__m128i *)((c) + 2 * 64 + (w) * 4), \
+	    _mm_unpacklo_epi64(_t2, _t3)); \
+	_mm_storeu_si128((__m128i *)((c) + 3 * 64 + (w) * 4), \
+	    _mm_unpackhi_epi64(_t2, _t3)); \
+} while (0)
+
+/*
+ * SSE2 version: four blocks per iteration.
+ */
+__attribute__((__target__("sse2"))) static void
+chacha_blocks_sse2(x, c, nblocks)
+	chacha_ctx *x;
+	unsigned char *c;
+	size_t nblocks;
+{
+	__m128i v[16], s[16];
+	uint32_t *j = x->input;
+	uint32_t lo;
+	int i;
+
+	for (; nblocks >= 4; nblocks -= 4, c += 4 * CHACHA_BLOCKSZ) {
+		for (i = 0; i < 16; i++)
+			s[i] = _mm_set1_epi32((int)j[i]);
+		lo = j[12];
+		s[12] = _mm_set_epi32((int)(lo + 3), (int)(lo + 2),
+		    (int)(lo + 1), (int)lo);
+		s[13] = _mm_set_epi32((int)(j[13] + (lo + 3 < lo)),
+		    (int)(j[13] + (lo + 2 < lo)), (int)(j[13] + (lo + 1 < lo)),
+		    (int)j[13]);
+		for (i = 0; i < 16; i++)
+			v[i] = s[i];
+		for (i = 20; i > 0; i -= 2)
+			VDOUBLEROUND(v, SSE2_QR);
+		for (i = 0; i < 16; i++)
+			v[i] = _mm_add_epi32(v[i], s[i]);
+		SSE2_STORE4(c, v, 0);
+		SSE2_STORE4(c, v, 4);
+		SSE2_STORE4(c, v, 8);
+		SSE2_STORE4(c, v, 12);
+		CHACHA_ADVANCE(x, 4);
+	}
+	chacha_blocks_ref(x, c, nblocks);
+}
+
+#define AVX2_ROTL(v, n) \
+	_mm256_or_si256(_mm256_slli_epi32(v, n), \
+	    _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_ROT16(v)	_mm256_shuffle_epi8(v, rot16)
+#define AVX2_ROT12(v)	AVX2_ROTL(v, 12)
+#define AVX2_ROT8(v)	_mm256_shuffle_epi8(v, rot8)
+#define AVX2_ROT7(v)	AVX2_ROTL(v, 7)
+#define AVX2_QR(a, b, c, d) VQUARTERROUND(a, b, c, d, _mm256_add_epi32, \
+	_mm256_xor_si256, AVX2_ROT16, AVX2_ROT12, AVX2_ROT8, AVX2_ROT7)
+
+/*
+ * As SSE2_STORE4 but each 128-bit half holds four blocks: the low
+ * half blocks 0-3 and the high half blocks 4-7.
+ */
+#define AVX2_STORE8(c, v, w) do { \
+	__m256i _t0 = _mm256_unpacklo_epi32(v[w], v[w + 1]); \
+	__m256i _t1 = _mm256_unpacklo_epi32(v[w + 2], v[w + 3]); \
+	__m256i _t2 = _mm256_unpackhi_epi32(v[w], v[w + 1]); \
+	__m256i _t3 = _mm256_unpackhi_epi32(v[w + 2], v[w + 3]); \
+	__m256i _r0 = _mm256_unpacklo_epi64(_t0, _t1); \
+	__m256i _r1 = _mm256_unpackhi_epi64(_t0, _t1); \
+	__m256i _r2 = _mm256_unpacklo_epi64(_t2, _t3); \
+	__m256i _r3 = _mm256_unpackhi_epi64(_t2, _t3); \
+	_mm_storeu_si128((__m128i *)((c) + 0 * 64 + (w) * 4), \
+	    _mm256_castsi256_si128(_r0)); \
+	_mm_storeu_si128((__m128i *)((c) + 1 * 64 + (w) * 4), \
+	    _mm256_castsi256_si128(_r1)); \
+	_mm_storeu_si128((__m128i *)((c) + 2 * 64 + (w) * 4), \
+	    _mm256_castsi256_si128(_r2)); \
+	_mm_storeu_si128((__m128i *)((c) + 3 * 64 + (w) * 4), \
+	    _mm256_castsi256_si128(_r3)); \
+	_mm_storeu_si128((__m128i *)((c) + 4 * 64 + (w) * 4), \
+	    _mm256_extracti128_si256(_r0, 1)); \
+	_mm_storeu_si128((__m128i *)((c) + 5 * 64 + (w) * 4), \
+	    _mm256_extracti128_si256(_r1, 1)); \
+	_mm_storeu_si128((__m128i *)((c) + 6 * 64 + (w) * 4), \
+	    _mm256_extracti128_si256(_r2, 1)); \
+	_mm_storeu_si128((__m128i *)((c) + 7 * 64 + (w) * 4), \
+	    _mm256_extracti128_si256(_r3, 1)); \
+} while (0)
+
+/*
+ * AVX2 version: eight blocks per iteration.
+ */
+__attribute__((__target__("avx2"))) static void
+chacha_blocks_avx2(x, c, nblocks)
+	chacha_ctx *x;
+	unsigned char *c;
+	size_t nblocks;
+{
+	__m256i v[16], s[16], rot16, rot8;
+	uint32_t *j = x->input;
+	uint32_t lo, ctr[8], hi[8];
+	int i;
+
+	rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10,
+	    5, 4, 7, 6, 1, 0, 3, 2, 13, 12, 15, 14, 9, 8, 11, 10,
+	    5, 4, 7, 6, 1, 0, 3, 2);
+	rot8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11,
+	    6, 5, 4, 7, 2, 1, 0, 3, 14, 13, 12, 15, 10, 9, 8, 11,
+	    6, 5, 4, 7, 2, 1, 0, 3);
+
+	for (; nblocks >= 8; nblocks -= 8, c += 8 * CHACHA_BLOCKSZ) {
+		for (i = 0; i < 16; i++)
+			s[i] = _mm256_set1_epi32((int)j[i]);
+		lo = j[12];
+		for (i = 0; i < 8; i++) {
+			ctr[i] = lo + i;
+			hi[i] = j[13] + (ctr[i] < lo);
+		}
+		s[12] = _mm256_loadu_si256((const __m256i *)ctr);
+		s[13] = _mm256_loadu_si256((const __m256i *)hi);
+		for (i = 0; i < 16; i++)
+			v[i] = s[i];
+		for (i = 20; i > 0; i -= 2)
+			VDOUBLEROUND(v, AVX2_QR);
+		for (i = 0; i < 16; i++)
+			v[i] = _mm256_add_epi32(v[i], s[i]);
+		AVX2_STORE8(c, v, 0);
+		AVX2_STORE8(c, v, 4);
+		AVX2_STORE8(c, v, 8);
+		AVX2_STORE8(c, v, 12);
+		CHACHA_ADVANCE(x, 8);
+	}
+	chacha_blocks_sse2(x, c, nblocks);
+}
+#endif /* HAVE_X86_SIMD */
+
+static void (*chacha_blocks) __P((chacha_ctx *, unsigned char *, size_t));
+
+/*
+ * Choose the fastest version the CPU supports, once, before the first
+ * chacha_keystream().  Threaded callers must not race to do it;
+ * arc4random.c does it under its seed lock.
+ */
+static void
+chacha_select()
+{
+	if (chacha_blocks != NULL)
+		return;
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		chacha_blocks = chacha_blocks_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		chacha_blocks = chacha_blocks_sse2;
+	else
+#endif
+		chacha_blocks = chacha_blocks_ref;
+}
+
+/*
+ * Fill c with nblocks blocks of keystream, the way chacha_select()
+ * chose.
+ */
+static void
+chacha_keystream(x, c, nblocks)
+	chacha_ctx *x;
+	unsigned char *c;
+	size_t nblocks;
+{
+	chacha_blocks(x, c, nblocks);
+}
+
+#endif /* _MKTEMP_CHACHA_PRIVATE_H */
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Running a command on a new entry (mktemp -e).
+ *
+ * "{}" in the command's arguments stands for the entry's name and
+ * "{fd}" for a descriptor open on it, which the command inherits.  The
+ * command is run directly, not through a shell.  We wait for it,
+ * passing on hangup, interrupt, quit and terminate signals, then remove
+ * the entry (and, for a directory, everything in it) and exit the way
+ * the command did.  With nothing to remove, the command simply takes
+ * our place.  A file in memory (mktemp -M) or one never linked (-a) has
+ * no name, so "{}" is its /proc/self/fd path and the descriptor is
+ * always passed on.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif /* HAVE_STRINGS_H */
+#endif /* HAVE_STRING_H */
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <extern.h>
+
+#ifndef O_DIRECTORY
+# define O_DIRECTORY	0
+#endif
+#ifndef O_NOFOLLOW
+# define O_NOFOLLOW	0
+#endif
+
+#define EXEC_PATH	"{}"
+#define EXEC_FD		"{fd}"
+
+extern char *__progname;
+
+static const int exec_signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM };
+#define NSIGNALS	(sizeof(exec_signals) / sizeof(exec_signals[0]))
+
+static volatile pid_t exec_child;
+
+static void
+exec_forward(signo)
+	int signo;
+{
+	if (exec_child > 0)
+		(void)kill(exec_child, signo);
+}
+
+/*
+ * Replace each "{}" in arg with path and each "{fd}" with fdstr.
+ * Returns arg itself if there are none, or NULL if out of memory.
+ */
+static char *
+exec_subst(arg, path, fdstr)
+	char *arg;
+	const char *path;
+	const char *fdstr;
+{
+	size_t plen = strlen(path), flen = strlen(fdstr), len = strlen(arg);
+	const char *cp;
+	char *buf, *bp;
+
+	if (strstr(arg, EXEC_PATH) == NULL && strstr(arg, EXEC_FD) == NULL)
+		return (arg);
+	/* There can be no more than len / 2 of either. */
+	if ((buf = (char *)malloc(len / 2 * (plen + flen) + len + 1)) == NULL)
+		return (NULL);
+	for (cp = arg, bp = buf; *cp != '\0'; ) {
+		if (strncmp(cp, EXEC_PATH, sizeof(EXEC_PATH) - 1) == 0) {
+			(void)memcpy(bp, path, plen);
+			bp += plen;
+			cp += sizeof(EXEC_PATH) - 1;
+		} else if (strncmp(cp, EXEC_FD, sizeof(EXEC_FD) - 1) == 0) {
+			(void)memcpy(bp, fdstr, flen);
+			bp += flen;
+			cp += sizeof(EXEC_FD) - 1;
+		} else
+			*bp++ = *cp++;
+	}
+	*bp = '\0';
+	return (buf);
+}
+
+/*
+ * Remove the directory name, relative to dfd, and everything in it,
+ * without following symbolic links or leaving the file system dev.
+ */
+static int
+exec_rmtree(dfd, name, dev)
+	int dfd;
+	const char *name;
+	dev_t dev;
+{
+#if defined(HAVE_OPENAT) && defined(HAVE_FDOPENDIR) && defined(HAVE_UNLINKAT)
+	struct dirent *dp;
+	struct stat sb;
+	DIR *dirp;
+	int fd, removed;
+
+	if (unlinkat(dfd, name, AT_REMOVEDIR) == 0)
+		return (0);
+	if (errno != ENOTEMPTY && errno != EEXIST)
+		return (-1);
+	if ((fd = openat(dfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW)) == -1)
+		return (-1);
+	if (fstat(fd, &sb) != 0 || sb.st_dev != dev ||
+	    (dirp = fdopendir(fd)) == NULL) {
+		(void)close(fd);
+		return (-1);
+	}
+	/* Go over it again until nothing more goes, in case we missed some. */
+	do {
+		removed = 0;
+		rewinddir(dirp);
+		while ((dp = readdir(dirp)) != NULL) {
+			if (strcmp(dp->d_name, ".") == 0 ||
+			    strcmp(dp->d_name, "..") == 0)
+				continue;
+			if (unlinkat(fd, dp->d_name, 0) == 0 ||
+			    ((errno == EISDIR || errno == EPERM) &&
+			    exec_rmtree(fd, dp->d_name, dev) == 0))
+				removed++;
+		}
+	} while (removed != 0);
+	(void)closedir(dirp);
+	return (unlinkat(dfd, name, AT_REMOVEDIR));
+#else
+	return (rmdir(name));
+#endif
+}
+
+static void
+exec_remove(path, isdir)
+	const char *path;
+	int isdir;
+{
+	struct stat sb;
+
+	if (!isdir)
+		(void)unlink(path);
+	else if (lstat(path, &sb) == 0 && S_ISDIR(sb.st_mode))
+		(void)exec_rmtree(AT_FDCWD, path, sb.st_dev);
+}
+
+static void
+exec_command(argv)
+	char **argv;
+{
+	int serrno;
+
+	(void)execvp(argv[0], argv);
+	serrno = errno;
+	(void)fprintf(stderr, "%s: %s: %s\n", __progname, argv[0],
+	    strerror(serrno));
+	_exit(serrno == ENOENT ? 127 : 126);
+}
+
+/*
+ * Run the command in argv on the entry at path, whose descriptor is fd
+ * (or -1), removing the entry afterwards if flags has EXEC_CLEANUP.
+ * Returns the exit value for mktemp.
+ */
+int
+run_exec(path, fd, isdir, flags, argv)
+	const char *path;
+	int fd;
+	int isdir;
+	int flags;
+	char **argv;
+{
+	struct sigaction sa, osa[NSIGNALS];
+	sigset_t mask, omask;
+	char fdstr[16], **nargv;
+	int i, n, status, rval = 1, usefd = 0;
+	pid_t pid;
+
+	(void)snprintf(fdstr, sizeof(fdstr), "%d", fd);
+	for (n = 0; argv[n] != NULL; n++)
+		continue;
+	if ((nargv = (char **)malloc((n + 1) * sizeof(char *))) == NULL)
+		goto nomem;
+	for (i = 0; i < n; i++) {
+		if ((nargv[i] = exec_subst(argv[i], path, fdstr)) == NULL)
+			goto nomem;
+		if (strstr(argv[i], EXEC_FD) != NULL)
+			usefd = 1;
+	}
+	nargv[n] = NULL;
+	/* Only pass the descriptor on if the command is told about it. */
+	if (fd != -1)
+		(void)fcntl(fd, F_SETFD,
+		    usefd || (flags & EXEC_PASSFD) ? 0 : FD_CLOEXEC);
+
+	if (!(flags & EXEC_CLEANUP))
+		exec_command(nargv);
+
+	/* Signals are held until the child is there to take them. */
+	(void)sigemptyset(&mask);
+	for (i = 0; i < (int)NSIGNALS; i++)
+		(void)sigaddset(&mask, exec_signals[i]);
+	(void)sigprocmask(SIG_BLOCK, &mask, &omask);
+	(void)memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = exec_forward;
+	(void)sigemptyset(&sa.sa_mask);
+	for (i = 0; i < (int)NSIGNALS; i++)
+		(void)sigaction(exec_signals[i], &sa, &osa[i]);
+
+	if ((pid = fork()) == 0) {
+		for (i = 0; i < (int)NSIGNALS; i++)
+			(void)sigaction(exec_signals[i], &osa[i], NULL);
+		(void)sigprocmask(SIG_SETMASK, &omask, NULL);
+		exec_command(nargv);
+	}
+	exec_child = pid;
+	(void)sigprocmask(SIG_SETMASK, &omask, NULL);
+	if (pid == -1) {
+		(void)fprintf(stderr, "%s: cannot fork: %s\n", __progname,
+		    strerror(errno));
+		exec_remove(path, isdir);
+		return (1);
+	}
+	if (fd != -1)
+		(void)close(fd);
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			status = -1;
+			break;
+		}
+	}
+	exec_child = -1;
+	exec_remove(path, isdir);
+
+	if (status != -1 && WIFEXITED(status))
+		rval = WEXITSTATUS(status);
+	else if (status != -1 && WIFSIGNALED(status)) {
+		/* Let whoever runs us see the command was interrupted. */
+		for (i = 0; i < (int)NSIGNALS; i++) {
+			if (exec_signals[i] == WTERMSIG(status) &&
+			    exec_signals[i] != SIGQUIT) {
+				(void)signal(exec_signals[i], SIG_DFL);
+				(void)kill(getpid(), exec_signals[i]);
+			}
+		}
+		rval = 128 + WTERMSIG(status);
+	}
+	return (rval);
+
+nomem:
+	(void)fprintf(stderr, "%s: cannot allocate memory\n", __progname);
+	exec_remove(path, isdir);
+	return (1);
+}
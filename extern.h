@@ -23,6 +23,65 @@ extern int errno;
 
 extern char *MKDTEMP __P((char *));
 extern int MKSTEMP __P((char *));
+
+#ifndef AT_FDCWD
+# define AT_FDCWD	-100
+#endif
+
+#include <libmktemp.h>
+
+/* Placement policies for a list of directories, see place.c. */
+#define PLACE_SPACE	0	/* in proportion to free space */
+#define PLACE_TMPFS	1	/* small files on tmpfs, the rest by space */
+#define PLACE_RR	2	/* round-robin, starting from our pid */
+#define PLACE_HASH	3	/* round-robin, starting from the template */
+
+extern int place_policy __P((const char *));
+extern int place_entries __P((char **, int, int, const char *, unsigned long,
+    off_t, int, unsigned long *));
+
+/* What reap() did, see reap.c. */
+struct reap_stats {
+	unsigned long files;	/* files and other non-directories removed */
+	unsigned long dirs;	/* directories removed */
+	unsigned long leased;	/* stale entries left alone for a lease */
+	unsigned long errors;	/* things that could not be removed */
+	double usecs;		/* time taken */
+};
+
+extern int reap __P((const char *, const char *, const char *, int, time_t,
+    unsigned long, struct reap_stats *));
+
+/* Running a command on the new entry, see exec.c. */
+#define EXEC_CLEANUP	0x01	/* remove the entry afterwards */
+#define EXEC_PASSFD	0x02	/* pass the descriptor on regardless */
+extern int run_exec __P((const char *, int, int, int, char **));
+
+/* Undoing a partly built directory skeleton, see skel.c. */
+extern void skel_remove __P((int, const struct mktemp_skel *));
+
+/* Just enough of an io_uring for batch creation, see uring.c. */
+struct io_uring_sqe;
+struct uring {
+	int fd;
+	unsigned int entries;		/* submission queue size */
+	unsigned int queued;		/* entries not yet submitted */
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	void *sqes, *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+extern int uring_open __P((struct uring *, unsigned int));
+extern void uring_close __P((struct uring *));
+extern struct io_uring_sqe *uring_sqe __P((struct uring *));
+extern int uring_submit __P((struct uring *, unsigned int));
+extern struct io_uring_sqe *uring_unsubmit __P((struct uring *));
+extern int uring_result __P((struct uring *, unsigned long long *, int *));
+
+extern int priv_mkstemp __P((char *));
+extern char *priv_mkdtemp __P((char *));
 #ifndef HAVE_ARC4RANDOM
 extern unsigned int arc4random __P((void));
 extern void arc4random_stir __P((void));
@@ -33,4 +92,10 @@ extern void arc4random_buf __P((void *, size_t));
 extern unsigned int arc4random_uniform __P((unsigned int));
 #endif
 
+/* Our own arc4random() is only built if the C library has neither. */
+#if !defined(HAVE_ARC4RANDOM) && !defined(HAVE_ARC4RANDOM_UNIFORM)
+# define PRIV_ARC4RANDOM
+extern unsigned long arc4_reseeds;
+#endif
+
 #endif /* _MKTEMP_EXTERN_H */
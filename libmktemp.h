@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Public interface to libmktemp, the temporary file engine used by
+ * mktemp(1).
+ *
+ * Templates are ordinary path names in a buffer supplied by the
+ * caller, ending in a run of 'X's optionally followed by suffixlen
+ * other characters.  The Xs are replaced in place; the library does
+ * not allocate memory when creating entries.  Functions that create
+ * something return -1 (or NULL) and set errno on failure, like
+ * mkstemp(3) and mkdtemp(3).
+ */
+
+#ifndef _LIBMKTEMP_H
+#define _LIBMKTEMP_H
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIBMKTEMP_VERSION	1
+
+struct mktemp_index;
+struct mktemp_seq;
+struct mktemp_node;
+struct mktemp_skel;
+
+/*
+ * Timing of the system calls that create entries, if a context asks
+ * for it.  hist[i] counts the calls that took from 2^i to 2^(i+1)
+ * nanoseconds; the last bucket also has any slower ones.  The time
+ * spent populating directories from a skeleton is kept apart.
+ */
+#define MKTEMP_HIST_BUCKETS	32
+
+struct mktemp_timing {
+	unsigned long calls;
+	unsigned long long nsecs;	/* total time taken */
+	unsigned long long max_nsecs;	/* longest single call */
+	unsigned long hist[MKTEMP_HIST_BUCKETS];
+	unsigned long long skel_nsecs;	/* building skeletons */
+};
+
+/*
+ * Optional per-caller options and statistics.  Zero it before first
+ * use.  A context must not be used by more than one thread at a time,
+ * though the index it points to may be shared.
+ */
+struct mktemp_ctx {
+	struct mktemp_index *index;	/* occupied names, or NULL */
+	off_t size;			/* size to preallocate new files to */
+	int advice;			/* posix_fadvise() advice, or 0 */
+	int provision;			/* MKTEMP_NOCOW */
+	int fanout;			/* levels of fan-out directories */
+	struct mktemp_timing *timing;	/* time system calls, or NULL */
+	struct mktemp_seq *seq;		/* name by counter, or NULL */
+	struct mktemp_node *node;	/* node namespace, or NULL */
+	const char *alphabet;		/* characters for the Xs, or NULL */
+	const struct mktemp_skel *skel;	/* contents of new directories */
+	unsigned long attempts;		/* creation system calls issued */
+	unsigned long collisions;	/* ... that failed with EEXIST */
+	unsigned long skipped;		/* names rejected by the index */
+	unsigned long hits;		/* entries taken from a reservoir */
+	unsigned long misses;		/* ... or not, as it was empty */
+	unsigned long rngbytes;		/* random bytes drawn for names */
+	unsigned long skelents;		/* entries made from skeletons */
+	unsigned long reflinks;		/* files cloned by mktemp_clone() */
+	unsigned long long copied;	/* ... or bytes it copied instead */
+};
+
+#define MKTEMP_NOCOW	0x01	/* no copy-on-write (btrfs), if possible */
+
+/*
+ * Alphabets for ctx->alphabet, what the Xs are replaced with; NULL
+ * means MKTEMP_ALNUM.  Any other string of at least two distinct
+ * characters will do, except that it may not include '/' (nor '.'
+ * with fan-out).  When there is a power of two of them, as for all
+ * but the default, each character is just a slice of a random word,
+ * with no values rejected.  Hex and base32 names are safe on file
+ * systems that ignore case.
+ */
+#define MKTEMP_ALNUM \
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"
+#define MKTEMP_HEX	"0123456789abcdef"
+#define MKTEMP_BASE32	"abcdefghijklmnopqrstuvwxyz234567"
+#define MKTEMP_BASE64URL \
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+
+/*
+ * Fan-out: with ctx->fanout set to n, the last component of path must
+ * follow n directories of two characters each, as in "dir/XX/XX/tmp.XXXX".
+ * They are named after the first 2 * n characters of the random suffix,
+ * which must be at least that long, and created as needed: mode 1777
+ * in a sticky, world-writable directory such as /tmp, so that other
+ * users can share them, and 0700 anywhere else.  Each is opened by
+ * itself without following symbolic links, and one that someone else
+ * left there is passed over for another name unless it is sticky and
+ * world-writable, or belongs to us and only we may write to it.  This
+ * keeps huge temporary directories from slowing down every lookup in
+ * them.
+ */
+
+/*
+ * Create and open a file, like mkostemps(3).  flags may include
+ * O_APPEND, O_CLOEXEC, O_DIRECT, O_DSYNC, O_NOATIME, O_RSYNC and
+ * O_SYNC where the system supports them; the file is always opened
+ * read/write.  mode is the permission the file is created with
+ * (subject to the umask), usually 0600.  Relative paths are resolved
+ * from dfd, which may be AT_FDCWD.  ctx may be NULL.
+ */
+int	mktemp_mkostempsat(int dfd, char *path, int suffixlen, int flags,
+	    mode_t mode, struct mktemp_ctx *ctx);
+int	mktemp_mkostemps(char *path, int suffixlen, int flags, mode_t mode);
+
+/*
+ * Create n files (or directories, if isdir) at once from the templates
+ * in paths[], each filled in as by the function above.  Where io_uring
+ * is available the creations are submitted to the kernel in batches,
+ * resubmitting only those that collide; elsewhere, and with fan-out,
+ * they are made one at a time.  The descriptors of new files are
+ * stored in fds, or closed if it is NULL.  Returns the number created,
+ * which are moved to the front of paths (and fds); if that is less
+ * than n, errno tells why the entry at that position in paths could
+ * not be made.
+ */
+int	mktemp_batchat(int dfd, char **paths, int n, int suffixlen, int flags,
+	    mode_t mode, int isdir, int *fds, struct mktemp_ctx *ctx);
+
+/*
+ * Provision a new, still empty file as ctx asks: disable copy-on-write,
+ * preallocate size bytes and give the access advice.  The functions
+ * above that take a ctx do this themselves before returning; new
+ * directories only get MKTEMP_NOCOW, which files made in them inherit.
+ * O_DIRECT, if passed, is likewise set once the file exists.  Only a
+ * failure to preallocate is an error.
+ */
+int	mktemp_provision(int fd, const struct mktemp_ctx *ctx);
+
+/*
+ * Fill a new, empty file with the contents of srcfd.  A regular file
+ * is read from the start without moving its offset; anything else is
+ * read from where it is to the end.  A reflink (FICLONE) shares the
+ * data outright where the file system can; otherwise it is copied in
+ * the kernel with copy_file_range(2) or sendfile(2), and only as a
+ * last resort by reading and writing it.  Each method carries on from
+ * wherever the one before had to stop.
+ */
+int	mktemp_clone(int srcfd, int fd, struct mktemp_ctx *ctx);
+
+/*
+ * Create a directory, like mkdtemp(3) but with a suffix and mode
+ * (usually 0700).  Returns path on success.
+ */
+char	*mktemp_mkdtempsat(int dfd, char *path, int suffixlen, mode_t mode,
+	    struct mktemp_ctx *ctx);
+
+/*
+ * Open an unnamed file (O_TMPFILE) in the directory path refers to.
+ * The file only gets a name if mktemp_linkat() is called, which fills
+ * in the Xs of path just as mktemp_mkostempsat() would.  Fails with
+ * EOPNOTSUPP (or EISDIR on some older kernels) where unsupported.
+ */
+int	mktemp_anonat(int dfd, char *path, int flags, mode_t mode);
+int	mktemp_linkat(int fd, int dfd, char *path, int suffixlen,
+	    struct mktemp_ctx *ctx);
+
+/*
+ * Create a file that lives only in memory, with memfd_create(2).  The
+ * Xs of path are filled in as usual but nothing is created there; the
+ * last component just names the file in /proc/<pid>/fd, for debugging.
+ * The file is provisioned as ctx asks and, if seals is not 0, sealed
+ * with those F_SEAL_* flags.  The descriptor is close-on-exec.  Fails
+ * with EOPNOTSUPP where memfd_create() is not available.
+ */
+int	mktemp_memfd(char *path, int suffixlen, int seals,
+	    struct mktemp_ctx *ctx);
+
+/*
+ * Fill in the Xs of path as the functions above would, but without
+ * creating anything or checking that the name is free, like mktemp(3).
+ * This is only meant for naming an entry that never gets a name of its
+ * own, such as an unnamed file that is never linked.
+ */
+int	mktemp_mktemps(char *path, int suffixlen, struct mktemp_ctx *ctx);
+
+/*
+ * Build an index of the names in the directory path refers to that
+ * could have been generated from it with the alphabet (and node) of
+ * ctx, for use in that context.  With an index, creation goes on to
+ * try every name in turn if random ones keep being taken, and fails
+ * straight away with EEXIST once all of them are.  Returns NULL if the
+ * directory cannot be read.
+ */
+struct mktemp_index *mktemp_index_create(int dfd, const char *path,
+	    int suffixlen, const struct mktemp_ctx *ctx);
+void	mktemp_index_free(struct mktemp_index *idx);
+
+/*
+ * A sequence of names for a context: rather than being drawn at random,
+ * each name is a counter encrypted with a random key, so no two names
+ * from one sequence are ever the same and only names someone else took
+ * cause a retry.  The names look just as random to anyone without the
+ * key.  One sequence may be shared by the threads of a process, but
+ * not with a child process, which would repeat it.
+ */
+struct mktemp_seq *mktemp_seq_create(void);
+void	mktemp_seq_free(struct mktemp_seq *seq);
+
+/*
+ * Node namespace, for a directory shared by the nodes of a cluster,
+ * say over NFS.  With ctx->node set, the last MKTEMP_NODE_CHARS Xs of
+ * each name are fixed for the node (a number below n^4 for an alphabet
+ * of n characters names a node directly, anything else is hashed; NULL
+ * or "" means the host name), so another node can only pick the same
+ * name if its id hashes alike.  Larger numbers fail with ERANGE, here
+ * if they could not fit any alphabet, otherwise when creating.
+ * Files and directories are created in a staging directory private to
+ * the node and user inside the one dfd refers to, then committed with
+ * a single renameat2(RENAME_NOREPLACE), or link and unlink where that
+ * is not supported.  If dfd is -1 there is no staging directory and
+ * entries are created in place.  A node may be shared by threads.
+ */
+#define MKTEMP_NODE_CHARS	4
+
+struct mktemp_node *mktemp_node_open(int dfd, const char *id);
+void	mktemp_node_close(struct mktemp_node *node);
+
+/*
+ * Directory skeletons.  mktemp_skel_parse() takes a list of relative
+ * paths separated by sep, each an empty file or, with a trailing
+ * slash, a directory; the directories they are in are implied.  With
+ * sep '\n' (the contents of a file), blanks around an entry and lines
+ * starting with '#' are ignored.  mktemp_skel_build() creates them in
+ * the directory dfd refers to, with modes 0777 and 0666 less the umask,
+ * returning how many it made.
+ * With ctx->skel set, a new directory is built in a staging directory
+ * next to it and only then renamed into place, so it never appears
+ * half populated.  That needs renameat2(RENAME_NOREPLACE); elsewhere
+ * an empty directory holds the name until it is replaced.
+ */
+struct mktemp_skel *mktemp_skel_parse(const char *spec, int sep);
+void	mktemp_skel_free(struct mktemp_skel *skel);
+int	mktemp_skel_build(int dfd, const struct mktemp_skel *skel);
+
+/*
+ * Reservoir of pre-created entries: a private staging directory in
+ * the directory dfd refers to, kept between low and high entries by
+ * mktemp_reservoir_fill().  mktemp_reservoir_claim() renames a staged
+ * file (or directory, if isdir) into place under a name made from
+ * path, which keeps its Xs if the reservoir is empty (ENOENT).
+ * Staged entries are created with mode 0600 (0700 for directories);
+ * a claimed one is then changed to mode, which the umask does not
+ * apply to.  Needs renameat2(); elsewhere these fail with EOPNOTSUPP.
+ */
+int	mktemp_reservoir_open(int dfd);
+int	mktemp_reservoir_claim(int rfd, int dfd, char *path, int suffixlen,
+	    int isdir, mode_t mode, struct mktemp_ctx *ctx);
+long	mktemp_reservoir_level(int rfd, int isdir);
+long	mktemp_reservoir_fill(int rfd, int isdir, unsigned long low,
+	    unsigned long high);
+
+/*
+ * Client side of the mktemp -D broker.  mktemp_broker_request() asks
+ * for count entries on a connection; each is then collected with
+ * mktemp_broker_recv(), which stores the name in path and returns an
+ * open descriptor for the entry.  If the broker could not create an
+ * entry, -1 is returned with errno set to the broker's error and the
+ * rest of that request is abandoned.
+ */
+int	mktemp_broker_connect(const char *sockpath);
+int	mktemp_broker_request(int sock, unsigned long count);
+int	mktemp_broker_recv(int sock, char *path, size_t size);
+
+/*
+ * Server side: mktemp_broker_accept() waits for a client, turning away
+ * those not running as the same user or root with EPERM.
+ * mktemp_broker_getreq() returns the number of entries a client wants,
+ * or 0 when it disconnects; each is answered with mktemp_broker_send(),
+ * passing error 0 and the entry's descriptor or an errno value to
+ * abandon the request.
+ */
+int	mktemp_broker_listen(const char *sockpath);
+int	mktemp_broker_accept(int lsock);
+unsigned long mktemp_broker_getreq(int sock);
+int	mktemp_broker_send(int sock, int fd, const char *path, int error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBMKTEMP_H */
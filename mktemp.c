@@ -45,7 +45,20 @@
 #ifdef HAVE_GETOPT_LONG
 #include <getopt.h>
 #endif /* HAVE_GETOPT_LONG */
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif /* HAVE_PTHREAD */
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 
 #include <extern.h>
 
@@ -53,23 +66,211 @@
 #define _PATH_TMP "/tmp"
 #endif
 
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
 #ifdef HAVE_PROGNAME
 extern char *__progname;
 #else
 char *__progname;
 #endif
 
+/*
+ * Settings shared by all workers in a batch.
+ */
+struct batch {
+	const char *prefix;	/* directory, without any trailing '/' */
+	size_t plen;		/* length of prefix, 0 if none */
+	const char *template;	/* template as given on the command line */
+	const char *alphabet;	/* characters for the Xs, or NULL */
+	size_t tlen;		/* length of template */
+	size_t foff;		/* offset of its last component */
+	int fanout;		/* fan-out directories before that */
+	int makedir;		/* create directories, not files */
+	int anon;		/* create files unnamed, then link them */
+	int nolink;		/* ... or leave them unnamed */
+	int memfd;		/* create files in memory, with no name */
+	int uflag;		/* unlink after creation */
+	int delim;		/* name terminator */
+	int lsock;		/* broker socket, -1 unless a daemon */
+	int srcfd;		/* file new files are cloned from, or -1 */
+	struct batch *next;	/* batch for the next directory, or NULL */
+#ifdef PRIV_MKTEMP
+	struct mktemp_index *index;	/* names already in use, or NULL */
+	int dfd;		/* directory the entries go in, or AT_FDCWD */
+	size_t roff;		/* offset of the name relative to dfd */
+	int rfd;		/* reservoir to claim entries from, or -1 */
+	mode_t rmode;		/* mode claimed entries are given */
+	struct mktemp_node *node;	/* node namespace, or NULL */
+	unsigned long rlow;	/* refill the reservoir below this level */
+	unsigned long rhigh;	/* ... up to this many entries */
+	int oflags;		/* extra open flags, e.g. O_DIRECT */
+	off_t size;		/* preallocate files to this size */
+	int advice;		/* posix_fadvise() advice for files */
+	int provision;		/* MKTEMP_NOCOW */
+	int seals;		/* F_SEAL_* flags for files in memory */
+	unsigned long bsize;	/* entries to create at a time */
+#endif
+};
+
+/*
+ * Per-worker state.  Each worker has its own path and output buffer
+ * so the only shared resource is the output stream itself.
+ */
+struct worker {
+	struct batch *batch;
+	unsigned long count;	/* number of entries to create */
+	unsigned long created;	/* number actually created */
+	char *path;		/* path being created */
+	char *out;		/* pending output */
+	size_t outlen;
+	int error;		/* errno from failed creation or write */
+	int werror;		/* set if the error was writing output */
+	int unnamed;		/* the entry was left without a name */
+#ifdef PRIV_MKTEMP
+	struct mktemp_ctx ctx;	/* options and statistics */
+	struct mktemp_timing timing;	/* of system calls, with -s */
+#endif
+};
+
+#define WORKER_OUTSIZE	65536
+
+/*
+ * Entries created at a time (-B).  The kernel hands io_uring creations
+ * to its own worker threads, which only pays off with CPUs to spare,
+ * so by default they are made one at a time.
+ */
+#define BATCH_SIZE	1
+
+/* Fan-out directories are two characters each, plus a slash. */
+#define FANOUT_MAX	2
+#define NAMELEN(b)	((b)->tlen + 3 * (b)->fanout)
+
+/* The directory fd is only ever used as a starting point for lookups. */
+#ifdef O_PATH
+# define O_DIRLOOKUP	(O_PATH|O_DIRECTORY)
+#elif defined(O_DIRECTORY)
+# define O_DIRLOOKUP	(O_RDONLY|O_DIRECTORY)
+#else
+# define O_DIRLOOKUP	O_RDONLY
+#endif
+
+/*
+ * With the private mk{s,d}temp each worker passes its own context
+ * and creates entries relative to the batch's directory.
+ */
+#ifdef PRIV_MKTEMP
+# define RELPATH(w)	((w)->path + (w)->batch->roff)
+# define MKSTEMP_W(w)	mktemp_mkostempsat((w)->batch->dfd, RELPATH(w), 0, \
+			    (w)->batch->oflags, S_IRUSR|S_IWUSR, &(w)->ctx)
+# define MKDTEMP_W(w)	mktemp_mkdtempsat((w)->batch->dfd, RELPATH(w), 0, \
+			    S_IRWXU, &(w)->ctx)
+# define CLONE_W(w, fd)	mktemp_clone((w)->batch->srcfd, (fd), &(w)->ctx)
+#else
+# define MKSTEMP_W(w)	MKSTEMP((w)->path)
+# define MKDTEMP_W(w)	MKDTEMP((w)->path)
+# define CLONE_W(w, fd)	mktemp_clone((w)->batch->srcfd, (fd), NULL)
+#endif
+#if defined(PRIV_MKTEMP) && defined(HAVE_UNLINKAT)
+# define UNLINK_W(w)	unlinkat((w)->batch->dfd, RELPATH(w), 0)
+# define RMDIR_W(w)	unlinkat((w)->batch->dfd, RELPATH(w), AT_REMOVEDIR)
+#else
+# define UNLINK_W(w)	unlink((w)->path)
+# define RMDIR_W(w)	rmdir((w)->path)
+#endif
+#if defined(PRIV_MKTEMP) && defined(HAVE_OPENAT)
+# define OPEN_W(w, f)	openat((w)->batch->dfd, RELPATH(w), (f))
+#else
+# define OPEN_W(w, f)	open((w)->path, (f))
+#endif
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t outlock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Socket to remove when the broker is told to quit. */
+static const char *broker_path;
+
+#if defined(PRIV_MKTEMP) && defined(HAVE_PTHREAD)
+/* The broker refills its reservoir from a thread of its own. */
+static pthread_mutex_t refill_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refill_cond = PTHREAD_COND_INITIALIZER;
+static int refill_wanted = 1;
+#endif
+
 void usage __P((void)) __attribute__((__noreturn__));
+static unsigned long getcount __P((const char *, const char *, int));
+static off_t getsize __P((const char *, int));
+static time_t getage __P((const char *, int));
+static void gethints __P((char *, int *, int *, int *, int));
+static const char *getalphabet __P((const char *, int, int));
+static void fill_name __P((struct batch *, char *));
+static char *make_path __P((struct batch *, char **));
+static int split_dirs __P((const char *, char ***));
+static int run_reap __P((struct batch *, char **, int, time_t, unsigned long,
+    int));
+#ifdef PRIV_MKTEMP
+static int getseals __P((char *, int));
+static struct mktemp_skel *getskel __P((const char *, int));
+static void checknode __P((const char *, const char *, int));
+static void open_batch __P((struct batch *, int, const char *, const char *,
+    int));
+static void open_dir __P((struct batch *));
+static void getwater __P((const char *, unsigned long *, unsigned long *,
+    int));
+static void open_reservoir __P((struct batch *, int));
+static void refill __P((struct batch *, int));
+# ifdef HAVE_PTHREAD
+static void *refill_worker __P((void *));
+# endif
+#endif
+static void print_stats __P((struct worker *, unsigned long, double, int));
+#ifdef PRIV_MKTEMP
+static int mkstemp_anon __P((struct worker *));
+#endif
+static int create_entry __P((struct worker *, int *));
+static int run_command __P((struct worker *, char **, int));
+static int flush_worker __P((struct worker *));
+static void *run_worker __P((void *));
+#ifdef PRIV_MKTEMP
+static int run_batch __P((struct worker *, size_t));
+#endif
+static void *serve_worker __P((void *));
+static int run_client __P((const char *, unsigned long, int, int));
+static void broker_quit __P((int));
 
 #ifdef HAVE_GETOPT_LONG
 static struct option const longopts[] =
 {
+  {"alphabet",	required_argument,	NULL,	'A'},
+  {"anonymous",	no_argument,		NULL,	'a'},
+  {"batch-size",	required_argument,	NULL,	'B'},
+  {"client",	required_argument,	NULL,	'C'},
+  {"clone-from",	required_argument,	NULL,	'f'},
+  {"counter",	no_argument,		NULL,	'c'},
+  {"count",	required_argument,	NULL,	'n'},
+  {"placement",	required_argument,	NULL,	'P'},
+  {"daemon",	required_argument,	NULL,	'D'},
   {"directory",	no_argument,		NULL,	'd'},
+  {"fanout",	required_argument,	NULL,	'F'},
   {"help",	no_argument,		NULL,	'h'},
+  {"hints",	required_argument,	NULL,	'o'},
+  {"index",	no_argument,		NULL,	'i'},
+  {"jobs",	required_argument,	NULL,	'j'},
+  {"skeleton",	required_argument,	NULL,	'k'},
+  {"memfd",	optional_argument,	NULL,	'M'},
+  {"node",	required_argument,	NULL,	'N'},
   {"quiet",	no_argument,		NULL,	'q'},
+  {"reap",	required_argument,	NULL,	'r'},
+  {"reservoir",	required_argument,	NULL,	'R'},
+  {"size",	required_argument,	NULL,	'S'},
+  {"stats",	optional_argument,	NULL,	's'},
   {"tmpdir",	optional_argument,	NULL,	'T'},
   {"dry-run",	no_argument,		NULL,	'u'},
+  {"exec",	no_argument,		NULL,	'e'},
   {"version",	no_argument,		NULL,	'V'},
+  {"zero",	no_argument,		NULL,	'z'},
   {NULL,	0,			NULL,	0}
 };
 #endif
@@ -79,9 +280,34 @@ main(argc, argv)
 	int argc;
 	char **argv;
 {
-	int ch, fd, uflag = 0, quiet = 0, tflag = 0, Tflag = 0, makedir = 0;
-	char *cp, *template, *tempfile, *prefix = _PATH_TMP;
+	int ch, uflag = 0, quiet = 0, tflag = 0, Tflag = 0, makedir = 0;
+	int aflag = 0, iflag = 0, sflag = 0, delim = '\n', error = 0;
+	int oflags = 0, advice = 0, provision = 0, policy = PLACE_SPACE;
+	int ndirs = 1, d, fanout = 0, cflag = 0, eflag = 0, mflag = 0, placed;
+	unsigned long count = 1, jobs = 1, nworkers, nbatches, per, nw;
+	unsigned long i, j, k;
+	unsigned long bsize = BATCH_SIZE;
+	unsigned long *counts;
+	off_t size = 0;
+	time_t age = -1;
+	char *cp, *template, *prefix = _PATH_TMP, **dirs;
+	char *client = NULL, *daemon = NULL, *reservoir = NULL, *node = NULL;
+	char *alphabet = NULL, *seals = NULL, *skelspec = NULL, **xargv = NULL;
+	char *clone = NULL;
 	size_t plen;
+	struct stat sb;
+	struct batch proto, *batches;
+#ifdef PRIV_MKTEMP
+	struct mktemp_seq *seq = NULL;
+	struct mktemp_skel *skel = NULL;
+#endif
+	struct worker *workers;
+	void *(*run) __P((void *)) = run_worker;
+#ifdef HAVE_PTHREAD
+	pthread_t *tids;
+	unsigned long nthreads;
+#endif
+	struct timeval start, end;
 	extern char *optarg;
 	extern int optind;
 
@@ -89,15 +315,94 @@ main(argc, argv)
 	__progname = argv[0];
 #endif
 
+	/* The command for -e follows "--", which getopt() must not see. */
+	for (d = 1; d < argc && strcmp(argv[d], "--") != 0; d++)
+		continue;
+	if (d < argc) {
+		xargv = argv + d + 1;
+		argv[d] = NULL;
+		argc = d;
+	}
+
 #ifdef HAVE_GETOPT_LONG
-	while ((ch = getopt_long(argc, argv, "dp:qtuV", longopts, NULL)) != -1)
+	while ((ch = getopt_long(argc, argv,
+	    "A:aB:C:cD:def:F:ij:k:MN:n:o:P:p:qR:r:S:stuVz", longopts,
+	    NULL)) != -1)
 #else
-	while ((ch = getopt(argc, argv, "dp:qtuV")) != -1)
+	while ((ch = getopt(argc, argv,
+	    "A:aB:C:cD:def:F:ij:k:MN:n:o:P:p:qR:r:S:stuVz")) != -1)
 #endif
 		switch (ch) {
+		case 'A':
+			alphabet = optarg;
+			break;
+		case 'a':
+			aflag = 1;
+			break;
+		case 'B':
+			bsize = getcount(optarg, "batch size", quiet);
+			break;
+		case 'C':
+			client = optarg;
+			break;
+		case 'c':
+			cflag = 1;
+			break;
+		case 'D':
+			daemon = optarg;
+			break;
 		case 'd':
 			makedir = 1;
 			break;
+		case 'e':
+			eflag = 1;
+			break;
+		case 'f':
+			clone = optarg;
+			break;
+		case 'F':
+			if ((i = getcount(optarg, "fan-out", quiet)) >
+			    FANOUT_MAX) {
+				if (!quiet)
+					(void)fprintf(stderr,
+					    "%s: invalid fan-out: %s\n",
+					    __progname, optarg);
+				exit(1);
+			}
+			fanout = (int)i;
+			break;
+		case 'i':
+			iflag = 1;
+			break;
+		case 'j':
+			jobs = getcount(optarg, "job count", quiet);
+			break;
+		case 'k':
+			skelspec = optarg;
+			break;
+		case 'M':
+			/* Only --memfd can take an argument. */
+			mflag = 1;
+			seals = optarg;
+			break;
+		case 'N':
+			node = optarg;
+			break;
+		case 'n':
+			count = getcount(optarg, "count", quiet);
+			break;
+		case 'o':
+			gethints(optarg, &oflags, &advice, &provision, quiet);
+			break;
+		case 'P':
+			if ((policy = place_policy(optarg)) == -1) {
+				if (!quiet)
+					(void)fprintf(stderr, "%s: unknown "
+					    "placement policy: %s\n",
+					    __progname, optarg);
+				exit(1);
+			}
+			break;
 		case 'p':
 			prefix = optarg;
 			tflag = 1;
@@ -105,6 +410,19 @@ main(argc, argv)
 		case 'q':
 			quiet = 1;
 			break;
+		case 'R':
+			reservoir = optarg;
+			break;
+		case 'r':
+			age = getage(optarg, quiet);
+			break;
+		case 'S':
+			size = getsize(optarg, quiet);
+			break;
+		case 's':
+			/* Only --stats can take an argument. */
+			sflag = optarg && strcmp(optarg, "json") == 0 ? 2 : 1;
+			break;
 		case 'T':
 			if (optarg) {
 				Tflag = 1;
@@ -120,11 +438,55 @@ main(argc, argv)
 		case 'V':
 			printf("%s version %s\n", __progname, PACKAGE_VERSION);
 			exit(0);
+		case 'z':
+			delim = '\0';
+			break;
 		default:
 			usage();
 	}
 
+	if (xargv != NULL && !eflag) {
+		/* Just the end of the options after all. */
+		if (optind == argc) {
+			argv = xargv;
+			for (argc = 0; argv[argc] != NULL; argc++)
+				continue;
+			optind = 0;
+		} else if (*xargv != NULL)
+			usage();
+		xargv = NULL;
+	}
+	if (eflag && (xargv == NULL || *xargv == NULL || count != 1 ||
+	    client != NULL || daemon != NULL || age != -1))
+		usage();
+	/* A file in memory can only be handed on as a descriptor. */
+	if (mflag && (makedir || aflag || fanout != 0 || reservoir != NULL ||
+	    age != -1 || (!eflag && daemon == NULL)))
+		usage();
+	/* A skeleton is for directories that are kept, not reservoirs. */
+	if (skelspec != NULL && (!makedir || uflag || reservoir != NULL ||
+	    age != -1))
+		usage();
+	/* A clone is sized by its source, and reservoirs have no data. */
+	if (clone != NULL && (makedir || mflag || reservoir != NULL ||
+	    size != 0 || age != -1))
+		usage();
+
+	/* The broker does all the work, including choosing names. */
+	if (client != NULL) {
+		if (daemon != NULL || age != -1 || argc != optind)
+			usage();
+		exit(run_client(client, count, delim, quiet));
+	}
+	if (daemon != NULL && age != -1)
+		usage();
+	if (!sflag && (cp = getenv("MKTEMP_STATS")) != NULL && *cp != '\0')
+		sflag = strcmp(cp, "json") == 0 ? 2 : 1;
+	if (node == NULL)
+		node = getenv("MKTEMP_NODE");
+
 	/* If no template specified use a default one (implies -t mode) */
+	placed = tflag;
 	switch (argc - optind) {
 	case 1:
 		template = argv[optind];
@@ -137,11 +499,40 @@ main(argc, argv)
 		usage();
 	}
 
+	/*
+	 * A clone is named after its source and, unless told where to
+	 * go, made next to it: on the same file system, where it can
+	 * share the source's data and later be renamed over it.
+	 */
+	if (clone != NULL) {
+		cp = strrchr(clone, '/');
+		if (argc == optind) {
+			plen = strlen(cp ? cp + 1 : clone);
+			if ((template = (char *)malloc(plen + 12)) == NULL)
+				goto nomem;
+			(void)memcpy(template, cp ? cp + 1 : clone, plen);
+			(void)memcpy(template + plen, ".XXXXXXXXXX", 12);
+		}
+		if (!placed && strchr(template, '/') == NULL) {
+			if (cp == NULL)
+				prefix = ".";
+			else if (cp == clone)
+				prefix = "/";
+			else {
+				if ((prefix = strdup(clone)) == NULL)
+					goto nomem;
+				prefix[cp - clone] = '\0';
+			}
+			tflag = Tflag = 1;
+		}
+	}
+
 	if (tflag) {
 		if (strchr(template, '/')) {
 			if (!quiet)
 				(void)fprintf(stderr,
-				    "%s: template must not contain directory separators in -t mode\n", __progname);
+				    "%s: template must not contain directory "
+				    "separators in -t mode\n", __progname);
 			exit(1);
 		}
 
@@ -150,60 +541,1505 @@ main(argc, argv)
 			if (cp != NULL && *cp != '\0')
 				prefix = cp;
 		}
-		plen = strlen(prefix);
-		while (plen != 0 && prefix[plen - 1] == '/')
-			plen--;
+	} else
+		prefix = NULL;
+
+	proto.prefix = NULL;
+	proto.plen = 0;
+	proto.template = template;
+	proto.tlen = strlen(template);
+	proto.alphabet = alphabet ?
+	    getalphabet(alphabet, fanout, quiet) : NULL;
+	cp = strrchr(template, '/');
+	proto.foff = cp ? (size_t)(cp + 1 - template) : 0;
+	proto.fanout = fanout;
+	proto.makedir = makedir;
+	proto.anon = aflag;
+	/*
+	 * Nobody will look for a file that is unlinked straight away, and
+	 * a command can be handed the descriptor.
+	 */
+	proto.nolink = aflag && (uflag || eflag);
+	proto.memfd = mflag;
+	proto.uflag = uflag;
+	proto.delim = delim;
+	proto.lsock = -1;
+	proto.srcfd = -1;
+	if (clone != NULL && ((proto.srcfd = open(clone, O_RDONLY)) == -1 ||
+	    fstat(proto.srcfd, &sb) != 0 ||
+	    (S_ISDIR(sb.st_mode) && (errno = EISDIR)))) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: cannot clone %s: %s\n",
+			    __progname, clone, strerror(errno));
+		exit(1);
+	}
+	proto.next = NULL;
+#ifdef PRIV_MKTEMP
+	proto.oflags = oflags;
+	proto.size = size;
+	proto.advice = advice;
+	proto.provision = provision;
+	proto.seals = seals ? getseals(seals, quiet) : 0;
+	proto.bsize = bsize;
+	if (cflag && (seq = mktemp_seq_create()) == NULL)
+		goto nomem;
+	if (skelspec != NULL)
+		skel = getskel(skelspec, quiet);
+	if (node != NULL)
+		checknode(node, proto.alphabet, quiet);
+#else
+	/*
+	 * The system mk{s,d}temp cannot use an index, reservoir or hints,
+	 * nor fan out.
+	 */
+	proto.fanout = 0;
+	(void)cflag;
+	(void)bsize;
+	(void)iflag;
+	(void)reservoir;
+	(void)node;
+	(void)oflags;
+	(void)advice;
+	(void)provision;
+	(void)seals;
+	if (mflag) {
+		if (!quiet)
+			(void)fprintf(stderr,
+			    "%s: cannot create files in memory: %s\n",
+			    __progname, strerror(EOPNOTSUPP));
+		exit(1);
+	}
+	if (skelspec != NULL) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: cannot use skeleton: %s\n",
+			    __progname, strerror(EOPNOTSUPP));
+		exit(1);
+	}
+#endif
+
+	/* A prefix may list several directories. */
+	dirs = &prefix;
+	if (prefix != NULL && strchr(prefix, ':') != NULL &&
+	    (ndirs = split_dirs(prefix, &dirs)) == -1)
+		goto nomem;
 
-		tempfile = (char *)malloc(plen + 1 + strlen(template) + 1);
-		if (tempfile == NULL) {
+	if (age != -1)
+		exit(run_reap(&proto, dirs, ndirs, age, jobs, quiet));
+
+	if (daemon != NULL) {
+		if ((proto.lsock = mktemp_broker_listen(daemon)) == -1) {
 			if (!quiet)
 				(void)fprintf(stderr,
-				    "%s: cannot allocate memory\n", __progname);
+				    "%s: cannot listen on %s: %s\n",
+				    __progname, daemon, strerror(errno));
 			exit(1);
 		}
-		(void)memcpy(tempfile, prefix, plen);
-		tempfile[plen] = '/';
-		(void)strcpy(tempfile + plen + 1, template);	/* SAFE */
-	} else {
-		if ((tempfile = strdup(template)) == NULL) {
+		broker_path = daemon;
+		(void)signal(SIGHUP, broker_quit);
+		(void)signal(SIGINT, broker_quit);
+		(void)signal(SIGTERM, broker_quit);
+		(void)signal(SIGPIPE, SIG_IGN);
+		run = serve_worker;
+	} else if (jobs > count)
+		jobs = count;
+
+	/*
+	 * Decide up front how many entries go in each directory and make
+	 * a batch for every one that gets some.  A broker places its
+	 * workers instead, as it has no count.
+	 */
+	if ((counts = (unsigned long *)calloc(ndirs, sizeof(*counts))) == NULL)
+		goto nomem;
+	if (ndirs == 1)
+		counts[0] = daemon ? jobs : count;
+	else if (place_entries(dirs, ndirs, policy, template,
+	    daemon ? jobs : count, size, makedir, counts) == -1)
+		goto nomem;
+	batches = (struct batch *)calloc(ndirs, sizeof(struct batch));
+	if (batches == NULL)
+		goto nomem;
+	for (d = 0, nbatches = 0; d < ndirs; d++) {
+		if (counts[d] == 0)
+			continue;
+		batches[nbatches] = proto;
+		if (dirs[d] != NULL) {
+			plen = strlen(dirs[d]);
+			while (plen != 0 && dirs[d][plen - 1] == '/')
+				plen--;
+			batches[nbatches].prefix = dirs[d];
+			batches[nbatches].plen = plen;
+		}
+#ifdef PRIV_MKTEMP
+		open_batch(&batches[nbatches], iflag, reservoir, node, quiet);
+#endif
+		if (nbatches != 0)
+			batches[nbatches - 1].next = &batches[nbatches];
+		counts[nbatches++] = counts[d];
+	}
+
+#if defined(PRIV_MKTEMP) && defined(HAVE_PTHREAD)
+	if (daemon != NULL) {
+		pthread_t tid;
+
+		for (i = 0; i < nbatches && batches[i].rfd == -1; i++)
+			continue;
+		if (i != nbatches && (errno = pthread_create(&tid, NULL,
+		    refill_worker, batches)) != 0) {
 			if (!quiet)
 				(void)fprintf(stderr,
-				    "%s: cannot allocate memory\n", __progname);
+				    "%s: cannot create thread: %s\n",
+				    __progname, strerror(errno));
 			exit(1);
 		}
 	}
+#endif
 
-	if (makedir) {
-		if (MKDTEMP(tempfile) == NULL) {
-			if (!quiet) {
-				(void)fprintf(stderr,
-				    "%s: cannot make temp dir %s: %s\n",
-				    __progname, tempfile, strerror(errno));
+	/*
+	 * Share the jobs out between the batches in proportion to their
+	 * entries, at least one each; a broker already has one per job.
+	 */
+	per = count / jobs + (count % jobs != 0);
+	for (i = 0, nworkers = 0; i < nbatches; i++) {
+		if (daemon != NULL || nbatches == 1)
+			nw = counts[i] < jobs ? counts[i] : jobs;
+		else
+			nw = counts[i] / per + (counts[i] % per != 0);
+		nworkers += nw;
+	}
+	workers = (struct worker *)calloc(nworkers, sizeof(struct worker));
+	if (workers == NULL)
+		goto nomem;
+	for (i = 0, j = 0; i < nbatches; i++) {
+		if (daemon != NULL || nbatches == 1)
+			nw = counts[i] < jobs ? counts[i] : jobs;
+		else
+			nw = counts[i] / per + (counts[i] % per != 0);
+		for (k = 0; k < nw; k++, j++) {
+			workers[j].batch = &batches[i];
+			workers[j].count = counts[i] / nw +
+			    (k < counts[i] % nw);
+#ifdef PRIV_MKTEMP
+			workers[j].ctx.index = batches[i].index;
+			workers[j].ctx.size = batches[i].size;
+			workers[j].ctx.advice = batches[i].advice;
+			workers[j].ctx.provision = batches[i].provision;
+			workers[j].ctx.fanout = batches[i].fanout;
+			workers[j].ctx.seq = seq;
+			workers[j].ctx.node = batches[i].node;
+			workers[j].ctx.alphabet = batches[i].alphabet;
+			workers[j].ctx.skel = skel;
+			if (sflag)
+				workers[j].ctx.timing = &workers[j].timing;
+#endif
+		}
+	}
+
+	if (eflag)
+		exit(run_command(&workers[0], xargv, quiet));
+
+	(void)gettimeofday(&start, NULL);
+#ifdef HAVE_PTHREAD
+	if (nworkers > 1) {
+		tids = (pthread_t *)calloc(nworkers, sizeof(pthread_t));
+		if (tids == NULL)
+			goto nomem;
+		/* Worker 0 runs in the main thread. */
+		for (i = 1; i < nworkers; i++) {
+			if ((errno = pthread_create(&tids[i], NULL, run,
+			    &workers[i])) != 0) {
+				if (!quiet)
+					(void)fprintf(stderr,
+					    "%s: cannot create thread: %s\n",
+					    __progname, strerror(errno));
+				break;
 			}
+		}
+		/* Anything not handed to a thread is done by the main one. */
+		nthreads = i;
+		(void)run(&workers[0]);
+		for (i = nthreads; i < nworkers; i++)
+			(void)run(&workers[i]);
+		for (i = 1; i < nthreads; i++)
+			(void)pthread_join(tids[i], NULL);
+		free(tids);
+	} else
+#endif /* HAVE_PTHREAD */
+	{
+		for (i = 0; i < nworkers; i++)
+			(void)run(&workers[i]);
+	}
+	(void)gettimeofday(&end, NULL);
+	if (daemon != NULL)
+		(void)unlink(daemon);
+#ifdef PRIV_MKTEMP
+	else {
+		for (i = 0; i < nbatches; i++) {
+			if (batches[i].rfd != -1)
+				refill(&batches[i], 1);
+		}
+	}
+#endif
+
+	/* Workers typically fail for the same reason, report only one. */
+	for (i = 0; i < nworkers; i++) {
+		if (workers[i].error == 0)
+			continue;
+		error = 1;
+		if (quiet)
+			break;
+		if (workers[i].werror && daemon != NULL) {
+			(void)fprintf(stderr, "%s: %s: %s\n",
+			    __progname, daemon, strerror(workers[i].error));
+		} else if (workers[i].path == NULL || workers[i].out == NULL) {
+			(void)fprintf(stderr, "%s: cannot allocate memory\n",
+			    __progname);
+		} else if (workers[i].werror) {
+			(void)fprintf(stderr, "%s: write error: %s\n",
+			    __progname, strerror(workers[i].error));
+		} else {
+			(void)fprintf(stderr, "%s: cannot %s %s: %s\n",
+			    __progname, makedir ?
+			    "make temp dir" : "create temp file",
+			    workers[i].path, strerror(workers[i].error));
+		}
+		break;
+	}
+
+	if (sflag)
+		print_stats(workers, nworkers, (end.tv_sec - start.tv_sec) +
+		    (end.tv_usec - start.tv_usec) / 1e6, sflag == 2);
+
+	exit(error);
+
+nomem:
+	if (!quiet)
+		(void)fprintf(stderr, "%s: cannot allocate memory\n",
+		    __progname);
+	exit(1);
+}
+
+/*
+ * Parse a positive decimal count for the named option.
+ */
+static unsigned long
+getcount(str, what, quiet)
+	const char *str;
+	const char *what;
+	int quiet;
+{
+	unsigned long val;
+	char *ep;
+
+	errno = 0;
+	val = strtoul(str, &ep, 10);
+	if (!isdigit((unsigned char)*str) || *ep != '\0' ||
+	    errno == ERANGE || val == 0) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: invalid %s: %s\n",
+			    __progname, what, str);
+		exit(1);
+	}
+	return (val);
+}
+
+/*
+ * Parse a file size, optionally followed by k, m, g or t (powers
+ * of 1024).
+ */
+static off_t
+getsize(str, quiet)
+	const char *str;
+	int quiet;
+{
+	unsigned long long val;
+	off_t size;
+	char *ep;
+	int shift = 0;
+
+	errno = 0;
+	val = strtoull(str, &ep, 10);
+	switch (*ep) {
+	case 't': case 'T':
+		shift += 10;
+		/* FALLTHROUGH */
+	case 'g': case 'G':
+		shift += 10;
+		/* FALLTHROUGH */
+	case 'm': case 'M':
+		shift += 10;
+		/* FALLTHROUGH */
+	case 'k': case 'K':
+		shift += 10;
+		ep++;
+		break;
+	}
+	size = (off_t)(val << shift);
+	if (!isdigit((unsigned char)*str) || *ep != '\0' ||
+	    errno == ERANGE || (val << shift) >> shift != val || size < 0 ||
+	    (unsigned long long)size != val << shift) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: invalid size: %s\n",
+			    __progname, str);
+		exit(1);
+	}
+	return (size);
+}
+
+/*
+ * Parse an age in seconds, optionally followed by m, h or d for
+ * minutes, hours or days.
+ */
+static time_t
+getage(str, quiet)
+	const char *str;
+	int quiet;
+{
+	unsigned long val, mult = 1;
+	char *ep;
+
+	errno = 0;
+	val = strtoul(str, &ep, 10);
+	switch (*ep) {
+	case 'd':
+		mult *= 24;
+		/* FALLTHROUGH */
+	case 'h':
+		mult *= 60;
+		/* FALLTHROUGH */
+	case 'm':
+		mult *= 60;
+		/* FALLTHROUGH */
+	case 's':
+		ep++;
+		break;
+	}
+	if (!isdigit((unsigned char)*str) || *ep != '\0' ||
+	    errno == ERANGE || val > LONG_MAX / mult) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: invalid age: %s\n",
+			    __progname, str);
+		exit(1);
+	}
+	return ((time_t)(val * mult));
+}
+
+/*
+ * Look up the named alphabet for the Xs, or take str as the characters
+ * themselves.  They must be distinct and usable in a name, which rules
+ * out '/' and, with fan-out, '.' (no fan-out directory may be "..").
+ */
+static const char *
+getalphabet(str, fanout, quiet)
+	const char *str;
+	int fanout;
+	int quiet;
+{
+	const char *cp;
+
+	if (strcmp(str, "alnum") == 0)
+		return (MKTEMP_ALNUM);
+	if (strcmp(str, "hex") == 0)
+		return (MKTEMP_HEX);
+	if (strcmp(str, "base32") == 0)
+		return (MKTEMP_BASE32);
+	if (strcmp(str, "base64url") == 0)
+		return (MKTEMP_BASE64URL);
+	for (cp = str; *cp != '\0'; cp++) {
+		if (*cp == '/' || (*cp == '.' && fanout != 0) ||
+		    strchr(cp + 1, *cp) != NULL)
+			break;
+	}
+	if (*cp != '\0' || cp - str < 2) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: invalid alphabet: %s\n",
+			    __progname, str);
+		exit(1);
+	}
+	return (str);
+}
+
+/*
+ * Parse a comma-separated list of access hints for new files.
+ */
+static void
+gethints(str, oflagsp, advicep, provisionp, quiet)
+	char *str;
+	int *oflagsp;
+	int *advicep;
+	int *provisionp;
+	int quiet;
+{
+	char *cp;
+
+	for (cp = strtok(str, ","); cp != NULL; cp = strtok(NULL, ",")) {
+		if (strcmp(cp, "nocow") == 0)
+			*provisionp |= MKTEMP_NOCOW;
+#ifdef O_DIRECT
+		else if (strcmp(cp, "direct") == 0)
+			*oflagsp |= O_DIRECT;
+#endif
+#ifdef POSIX_FADV_SEQUENTIAL
+		else if (strcmp(cp, "sequential") == 0)
+			*advicep = POSIX_FADV_SEQUENTIAL;
+		else if (strcmp(cp, "random") == 0)
+			*advicep = POSIX_FADV_RANDOM;
+		else if (strcmp(cp, "noreuse") == 0)
+			*advicep = POSIX_FADV_NOREUSE;
+		else if (strcmp(cp, "willneed") == 0)
+			*advicep = POSIX_FADV_WILLNEED;
+		else if (strcmp(cp, "dontneed") == 0)
+			*advicep = POSIX_FADV_DONTNEED;
+#endif
+		else {
+			if (!quiet)
+				(void)fprintf(stderr,
+				    "%s: unknown or unsupported hint: %s\n",
+				    __progname, cp);
 			exit(1);
 		}
+	}
+}
 
-		if (uflag)
-			(void)rmdir(tempfile);
-	} else {
-		if ((fd = MKSTEMP(tempfile)) < 0) {
-			if (!quiet) {
+#ifdef PRIV_MKTEMP
+/*
+ * Parse the seals for a file in memory, a comma-separated list of
+ * "grow", "shrink", "write" and "seal" (no further seals).
+ */
+static int
+getseals(str, quiet)
+	char *str;
+	int quiet;
+{
+	char *cp;
+	int seals = 0;
+
+	for (cp = strtok(str, ","); cp != NULL; cp = strtok(NULL, ",")) {
+#ifdef F_SEAL_SEAL
+		if (strcmp(cp, "grow") == 0)
+			seals |= F_SEAL_GROW;
+		else if (strcmp(cp, "shrink") == 0)
+			seals |= F_SEAL_SHRINK;
+		else if (strcmp(cp, "write") == 0)
+			seals |= F_SEAL_WRITE;
+		else if (strcmp(cp, "seal") == 0)
+			seals |= F_SEAL_SEAL;
+		else
+#endif
+		{
+			if (!quiet)
 				(void)fprintf(stderr,
-				    "%s: cannot create temp file %s: %s\n",
-				    __progname, tempfile, strerror(errno));
+				    "%s: unknown or unsupported seal: %s\n",
+				    __progname, cp);
+			exit(1);
+		}
+	}
+	return (seals);
+}
+
+/*
+ * Load a directory skeleton: inline, with entries separated by commas,
+ * or from a file, one per line, if spec is "@file" ("@-" for stdin).
+ */
+static struct mktemp_skel *
+getskel(spec, quiet)
+	const char *spec;
+	int quiet;
+{
+	struct mktemp_skel *skel = NULL;
+	FILE *fp;
+	char *buf = NULL, *nbuf;
+	size_t len = 0, size = 0, n;
+
+	if (*spec != '@')
+		skel = mktemp_skel_parse(spec, ',');
+	else if (strcmp(spec + 1, "-") == 0 ||
+	    (fp = fopen(spec + 1, "r")) != NULL) {
+		if (strcmp(spec + 1, "-") == 0)
+			fp = stdin;
+		for (;;) {
+			if (size - len < BUFSIZ) {
+				nbuf = (char *)realloc(buf, size + BUFSIZ * 4);
+				if (nbuf == NULL)
+					break;
+				buf = nbuf;
+				size += BUFSIZ * 4;
 			}
+			if ((n = fread(buf + len, 1, size - len - 1, fp)) == 0)
+				break;
+			len += n;
+		}
+		/* Give up if memory ran out or the file could not be read. */
+		if (nbuf != NULL && !ferror(fp)) {
+			buf[len] = '\0';
+			skel = mktemp_skel_parse(buf, '\n');
+		}
+		if (fp != stdin)
+			(void)fclose(fp);
+		free(buf);
+	}
+	if (skel == NULL) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: invalid skeleton %s: %s\n",
+			    __progname, spec, strerror(errno));
+		exit(1);
+	}
+	return (skel);
+}
+
+/*
+ * A node number is used as is, so it must be one the alphabet can
+ * spell in MKTEMP_NODE_CHARS characters; anything else is hashed.
+ */
+static void
+checknode(node, alphabet, quiet)
+	const char *node;
+	const char *alphabet;
+	int quiet;
+{
+	unsigned long val, space, n;
+	int i;
+
+	if (*node == '\0' || node[strspn(node, "0123456789")] != '\0')
+		return;
+	n = strlen(alphabet ? alphabet : MKTEMP_ALNUM);
+	for (space = 1, i = 0; i < MKTEMP_NODE_CHARS; i++)
+		space *= n;
+	errno = 0;
+	val = strtoul(node, NULL, 10);
+	if (errno == ERANGE || val >= space) {
+		if (!quiet)
+			(void)fprintf(stderr,
+			    "%s: node number must be below %lu: %s\n",
+			    __progname, space, node);
+		exit(1);
+	}
+}
+#endif /* PRIV_MKTEMP */
+
+/*
+ * Copy the batch template to name, with the fan-out directories (if
+ * any) in front of its last component.
+ */
+static void
+fill_name(b, name)
+	struct batch *b;
+	char *name;
+{
+	int i;
+
+	(void)memcpy(name, b->template, b->foff);
+	name += b->foff;
+	for (i = 0; i < b->fanout; i++) {
+		*name++ = 'X';
+		*name++ = 'X';
+		*name++ = '/';
+	}
+	(void)memcpy(name, b->template + b->foff, b->tlen - b->foff + 1);
+}
+
+/*
+ * Allocate a path for the batch template, rooted in the prefix if
+ * there is one.  If namep is not NULL it is set to the template part.
+ */
+static char *
+make_path(b, namep)
+	struct batch *b;
+	char **namep;
+{
+	char *path, *name;
+
+	path = (char *)malloc((b->prefix ? b->plen + 1 : 0) + NAMELEN(b) + 1);
+	if (path == NULL)
+		return (NULL);
+	if (b->prefix != NULL) {
+		(void)memcpy(path, b->prefix, b->plen);
+		path[b->plen] = '/';
+		name = path + b->plen + 1;
+	} else
+		name = path;
+	fill_name(b, name);
+	if (namep != NULL)
+		*namep = name;
+	return (path);
+}
+
+/*
+ * Split a colon-separated list of directories, like PATH.  Empty
+ * elements are ignored.  Returns the number of directories found.
+ */
+static int
+split_dirs(list, dirsp)
+	const char *list;
+	char ***dirsp;
+{
+	char *copy, *cp, **dirs;
+	int n = 1;
+
+	for (cp = (char *)list; *cp != '\0'; cp++) {
+		if (*cp == ':')
+			n++;
+	}
+	copy = strdup(list);
+	dirs = (char **)malloc(n * sizeof(char *));
+	if (copy == NULL || dirs == NULL) {
+		free(copy);
+		free(dirs);
+		return (-1);
+	}
+	n = 0;
+	for (cp = strtok(copy, ":"); cp != NULL; cp = strtok(NULL, ":"))
+		dirs[n++] = cp;
+	if (n == 0)
+		dirs[n++] = _PATH_TMP;
+	*dirsp = dirs;
+	return (n);
+}
+
+/*
+ * Remove stale entries made from the batch template in each of the
+ * directories and report how it went.
+ */
+static int
+run_reap(b, dirs, ndirs, age, jobs, quiet)
+	struct batch *b;
+	char **dirs;
+	int ndirs;
+	time_t age;
+	unsigned long jobs;
+	int quiet;
+{
+	struct reap_stats st;
+	char *dir;
+	size_t dlen, tlen;
+	double secs;
+	int d, error = 0;
+
+	for (d = 0; d < ndirs; d++) {
+		/* The directory part of the template is relative to it. */
+		dlen = dirs[d] ? strlen(dirs[d]) : 0;
+		tlen = b->foff > 1 ? b->foff - 1 : b->foff;
+		if ((dir = (char *)malloc(dlen + tlen + 3)) == NULL) {
+			if (!quiet)
+				(void)fprintf(stderr, "%s: cannot allocate "
+				    "memory\n", __progname);
+			return (1);
+		}
+		if (dlen != 0)
+			(void)memcpy(dir, dirs[d], dlen);
+		if (tlen != 0) {
+			if (dlen != 0)
+				dir[dlen++] = '/';
+			(void)memcpy(dir + dlen, b->template, tlen);
+		} else if (dlen == 0)
+			dir[dlen++] = '.';
+		dir[dlen + tlen] = '\0';
+
+		if (reap(dir, b->template + b->foff, b->alphabet, b->fanout,
+		    age, jobs, &st) != 0) {
+			if (!quiet)
+				(void)fprintf(stderr,
+				    "%s: cannot reap %s: %s\n",
+				    __progname, dir, strerror(errno));
+			error = 1;
+			free(dir);
+			continue;
+		}
+		secs = st.usecs / 1e6;
+		(void)printf("%s: removed %lu files and %lu directories in "
+		    "%.3f seconds, %.0f files/sec", dir, st.files, st.dirs,
+		    secs, secs > 0 ? st.files / secs : 0.0);
+		if (st.leased != 0)
+			(void)printf(", %lu leased", st.leased);
+		if (st.errors != 0) {
+			(void)printf(", %lu could not be removed", st.errors);
+			error = 1;
+		}
+		(void)putchar('\n');
+		free(dir);
+	}
+	if (fflush(stdout) == EOF) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: write error: %s\n",
+			    __progname, strerror(errno));
+		return (1);
+	}
+	return (error);
+}
+
+#ifdef PRIV_MKTEMP
+/*
+ * Set up a batch for the directory it goes in: open the directory,
+ * index it and find its reservoir and node namespace, as asked.
+ */
+static void
+open_batch(b, iflag, reservoir, node, quiet)
+	struct batch *b;
+	int iflag;
+	const char *reservoir;
+	const char *node;
+	int quiet;
+{
+	struct mktemp_ctx ctx;
+	char *path;
+
+	open_dir(b);
+	b->rfd = -1;
+	if (reservoir != NULL) {
+		getwater(reservoir, &b->rlow, &b->rhigh, quiet);
+		open_reservoir(b, quiet);
+	}
+	b->node = NULL;
+	if (node != NULL) {
+		/*
+		 * Unlike a reservoir, the namespace is not just an
+		 * optimization, so failing to set it up is fatal.  If the
+		 * directory could not be opened there is nowhere to stage.
+		 */
+		b->node = mktemp_node_open(b->dfd == AT_FDCWD &&
+		    (b->prefix != NULL || strchr(b->template, '/') != NULL) ?
+		    -1 : b->dfd, node);
+		if (b->node == NULL) {
+			if (!quiet)
+				(void)fprintf(stderr,
+				    "%s: cannot use node namespace: %s\n",
+				    __progname, strerror(errno));
 			exit(1);
 		}
+	}
+	b->index = NULL;
+	/* The index only covers the top directory, no use with fan-out. */
+	if (iflag && b->fanout == 0) {
+		/* Without an index we just fall back to trial and error. */
+		(void)memset(&ctx, 0, sizeof(ctx));
+		ctx.alphabet = b->alphabet;
+		ctx.node = b->node;
+		if ((path = make_path(b, NULL)) != NULL) {
+			b->index = mktemp_index_create(b->dfd, path + b->roff,
+			    0, &ctx);
+			free(path);
+		}
+	}
+}
+
+/*
+ * Create the file without a name (O_TMPFILE) and only then link it
+ * into the directory under a random name, unless it needs none.
+ * Where that is not supported, fall back to creating it by name.
+ */
+static int
+mkstemp_anon(w)
+	struct worker *w;
+{
+	struct batch *b = w->batch;
+	char *fan = NULL;
+	int fd, serrno;
+
+	/* Open it in the top directory, the fan-out may not exist yet. */
+	if (b->fanout != 0) {
+		fan = w->path + (b->prefix ? b->plen + 1 : 0) + b->foff;
+		*fan = '\0';
+	}
+	fd = mktemp_anonat(b->dfd, RELPATH(w), b->oflags, S_IRUSR|S_IWUSR);
+	serrno = errno;
+	if (fan != NULL)
+		*fan = 'X';
+	errno = serrno;
+	if (fd == -1) {
+		if (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)
+			return (MKSTEMP_W(w));
+		return (-1);
+	}
+	/* Provision it while nobody else can see it yet. */
+	if (mktemp_provision(fd, &w->ctx) != 0 || (!b->nolink &&
+	    mktemp_linkat(fd, b->dfd, RELPATH(w), 0, &w->ctx) != 0)) {
+		serrno = errno;
 		(void)close(fd);
+		errno = serrno;
+		return (-1);
+	}
+	/* A name it could have had will do. */
+	if (b->nolink)
+		(void)mktemp_mktemps(RELPATH(w), 0, &w->ctx);
+	w->unnamed = b->nolink;
+	return (fd);
+}
 
-		if (uflag)
-			(void)unlink(tempfile);
+/*
+ * Open the directory the batch goes in once so that each creation
+ * only has to look up the final component.  If that fails we just
+ * use full paths, which also gives the usual error messages.
+ */
+static void
+open_dir(b)
+	struct batch *b;
+{
+	char *path, *name, *base;
+
+	b->dfd = AT_FDCWD;
+	b->roff = 0;
+#ifdef HAVE_OPENAT
+	if ((path = make_path(b, &name)) == NULL)
+		return;
+	/* Fan-out directories are made relative to the one above them. */
+	name[b->foff] = '\0';
+	if ((base = strrchr(name, '/')) == NULL && b->prefix != NULL)
+		base = name - 1;
+	if (base != NULL) {
+		if (base == path)
+			b->dfd = open("/", O_DIRLOOKUP);
+		else {
+			*base = '\0';
+			b->dfd = open(path, O_DIRLOOKUP);
+		}
+		if (b->dfd == -1)
+			b->dfd = AT_FDCWD;
+		else
+			b->roff = (size_t)(base + 1 - path);
+	}
+	free(path);
+#endif /* HAVE_OPENAT */
+}
+
+/*
+ * Parse the reservoir watermarks, "low:high" or just "high" in which
+ * case the reservoir is refilled once half empty.
+ */
+static void
+getwater(str, lowp, highp, quiet)
+	const char *str;
+	unsigned long *lowp;
+	unsigned long *highp;
+	int quiet;
+{
+	unsigned long low, high;
+	const char *hp = str;
+	char *ep;
+
+	errno = 0;
+	low = high = strtoul(str, &ep, 10);
+	if (*ep == ':') {
+		hp = ep + 1;
+		high = strtoul(hp, &ep, 10);
+	} else
+		low = high / 2;
+	if (!isdigit((unsigned char)*str) || !isdigit((unsigned char)*hp) ||
+	    *ep != '\0' || errno == ERANGE || high == 0 || low > high) {
+		if (!quiet)
+			(void)fprintf(stderr,
+			    "%s: invalid reservoir size: %s\n",
+			    __progname, str);
+		exit(1);
+	}
+	*lowp = low;
+	*highp = high;
+}
+
+/*
+ * The reservoir lives in the directory the batch goes in.  Without
+ * one we just create everything directly.
+ */
+static void
+open_reservoir(b, quiet)
+	struct batch *b;
+	int quiet;
+{
+	mode_t mask;
+
+	/* If the directory could not be opened, neither can this. */
+	if (b->dfd == AT_FDCWD && (b->prefix != NULL ||
+	    strchr(b->template, '/') != NULL))
+		return;
+	/* Claimed entries end up as if they had just been created. */
+	mask = umask(0);
+	(void)umask(mask);
+	b->rmode = (b->makedir ? S_IRWXU : S_IRUSR|S_IWUSR) & ~mask;
+	if ((b->rfd = mktemp_reservoir_open(b->dfd)) == -1 && !quiet)
+		(void)fprintf(stderr, "%s: cannot use reservoir: %s\n",
+		    __progname, strerror(errno));
+}
+
+/*
+ * Top up the reservoir if it has run low.  The broker's refill thread
+ * does the work if there is one.  Otherwise, when exiting, a child is
+ * left to do it so our caller need not wait.
+ */
+static void
+refill(b, exiting)
+	struct batch *b;
+	int exiting;
+{
+	long level;
+
+#ifdef HAVE_PTHREAD
+	if (!exiting) {
+		(void)pthread_mutex_lock(&refill_lock);
+		refill_wanted = 1;
+		(void)pthread_cond_signal(&refill_cond);
+		(void)pthread_mutex_unlock(&refill_lock);
+		return;
+	}
+#endif
+	level = mktemp_reservoir_level(b->rfd, b->makedir);
+	if (level == -1 || (unsigned long)level >= b->rlow)
+		return;
+	if (exiting) {
+		switch (fork()) {
+		case -1:
+			return;
+		case 0:
+			/* Don't hold on to our caller's pipes. */
+			(void)close(STDIN_FILENO);
+			(void)close(STDOUT_FILENO);
+			(void)close(STDERR_FILENO);
+			(void)mktemp_reservoir_fill(b->rfd, b->makedir,
+			    b->rlow, b->rhigh);
+			_exit(0);
+		default:
+			return;
+		}
 	}
+	(void)mktemp_reservoir_fill(b->rfd, b->makedir, b->rlow, b->rhigh);
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+refill_worker(arg)
+	void *arg;
+{
+	struct batch *b;
 
-	(void)puts(tempfile);
-	free(tempfile);
+	(void)pthread_mutex_lock(&refill_lock);
+	for (;;) {
+		while (!refill_wanted)
+			(void)pthread_cond_wait(&refill_cond, &refill_lock);
+		refill_wanted = 0;
+		(void)pthread_mutex_unlock(&refill_lock);
+		for (b = (struct batch *)arg; b != NULL; b = b->next) {
+			if (b->rfd != -1)
+				(void)mktemp_reservoir_fill(b->rfd, b->makedir,
+				    b->rlow, b->rhigh);
+		}
+		(void)pthread_mutex_lock(&refill_lock);
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+#endif /* HAVE_PTHREAD */
+#endif /* PRIV_MKTEMP */
+
+/*
+ * Report what the workers did on stderr, as text or a line of JSON,
+ * including a histogram of how long the creation system calls took.
+ */
+static void
+print_stats(workers, jobs, secs, json)
+	struct worker *workers;
+	unsigned long jobs;
+	double secs;
+	int json;
+{
+	unsigned long i, created = 0;
+	double rate;
+#ifdef PRIV_MKTEMP
+	struct mktemp_ctx sum;
+	struct mktemp_timing tm;
+	int b, reservoir = 0, skeleton = 0, cloning = 0, sep = 0;
+
+	(void)memset(&sum, 0, sizeof(sum));
+	(void)memset(&tm, 0, sizeof(tm));
+#endif
 
-	exit(0);
+	for (i = 0; i < jobs; i++) {
+		created += workers[i].created;
+#ifdef PRIV_MKTEMP
+		sum.attempts += workers[i].ctx.attempts;
+		sum.collisions += workers[i].ctx.collisions;
+		sum.skipped += workers[i].ctx.skipped;
+		sum.hits += workers[i].ctx.hits;
+		sum.misses += workers[i].ctx.misses;
+		sum.rngbytes += workers[i].ctx.rngbytes;
+		sum.skelents += workers[i].ctx.skelents;
+		sum.reflinks += workers[i].ctx.reflinks;
+		sum.copied += workers[i].ctx.copied;
+		cloning |= workers[i].batch->srcfd != -1;
+		reservoir |= workers[i].batch->rfd != -1;
+		skeleton |= workers[i].ctx.skel != NULL;
+		tm.calls += workers[i].timing.calls;
+		tm.nsecs += workers[i].timing.nsecs;
+		if (workers[i].timing.max_nsecs > tm.max_nsecs)
+			tm.max_nsecs = workers[i].timing.max_nsecs;
+		for (b = 0; b < MKTEMP_HIST_BUCKETS; b++)
+			tm.hist[b] += workers[i].timing.hist[b];
+		tm.skel_nsecs += workers[i].timing.skel_nsecs;
+#endif
+	}
+	rate = secs > 0 ? created / secs : 0;
+
+	if (json) {
+		(void)fprintf(stderr, "{\"created\": %lu, \"seconds\": %.6f, "
+		    "\"per_sec\": %.0f", created, secs, rate);
+#ifdef PRIV_MKTEMP
+		(void)fprintf(stderr, ", \"attempts\": %lu, "
+		    "\"collisions\": %lu, \"skipped\": %lu, "
+		    "\"reservoir_hits\": %lu, \"reservoir_misses\": %lu, "
+		    "\"rng_bytes\": %lu", sum.attempts, sum.collisions,
+		    sum.skipped, sum.hits, sum.misses, sum.rngbytes);
+# ifdef PRIV_ARC4RANDOM
+		(void)fprintf(stderr, ", \"reseeds\": %lu", arc4_reseeds);
+# endif
+		(void)fprintf(stderr, ", \"skeleton_entries\": %lu, "
+		    "\"skeleton_us\": %.3f", sum.skelents,
+		    tm.skel_nsecs / 1e3);
+		(void)fprintf(stderr, ", \"reflinks\": %lu, "
+		    "\"copied_bytes\": %llu", sum.reflinks, sum.copied);
+		(void)fprintf(stderr, ", \"calls\": %lu, \"mean_us\": %.3f, "
+		    "\"max_us\": %.3f, \"histogram\": [", tm.calls,
+		    tm.calls ? tm.nsecs / 1e3 / tm.calls : 0.0,
+		    tm.max_nsecs / 1e3);
+		for (b = 0; b < MKTEMP_HIST_BUCKETS; b++) {
+			if (tm.hist[b] == 0)
+				continue;
+			(void)fprintf(stderr,
+			    "%s{\"ge_ns\": %llu, \"calls\": %lu}",
+			    sep++ ? ", " : "", b ? 1ULL << b : 0ULL,
+			    tm.hist[b]);
+		}
+		(void)fputc(']', stderr);
+#endif
+		(void)fputs("}\n", stderr);
+		return;
+	}
+
+	(void)fprintf(stderr,
+	    "%s: %lu created in %.3f seconds, %.0f per second\n",
+	    __progname, created, secs, rate);
+#ifdef PRIV_MKTEMP
+	(void)fprintf(stderr, "%s: %lu attempts, "
+	    "%lu collisions, %lu skipped by index\n", __progname,
+	    sum.attempts, sum.collisions, sum.skipped);
+	if (reservoir)
+		(void)fprintf(stderr, "%s: %lu reservoir hits, %lu misses\n",
+		    __progname, sum.hits, sum.misses);
+# ifdef PRIV_ARC4RANDOM
+	(void)fprintf(stderr, "%s: %lu random bytes, %lu reseeds\n",
+	    __progname, sum.rngbytes, arc4_reseeds);
+# else
+	(void)fprintf(stderr, "%s: %lu random bytes\n", __progname,
+	    sum.rngbytes);
+# endif
+	if (cloning)
+		(void)fprintf(stderr, "%s: %lu reflinked, %llu bytes copied\n",
+		    __progname, sum.reflinks, sum.copied);
+	if (skeleton)
+		(void)fprintf(stderr, "%s: %lu skeleton entries, %.3f us "
+		    "per directory\n", __progname, sum.skelents,
+		    created ? tm.skel_nsecs / 1e3 / created : 0.0);
+	if (tm.calls == 0)
+		return;
+	(void)fprintf(stderr, "%s: %lu system calls, mean %.3f us, "
+	    "max %.3f us\n", __progname, tm.calls, tm.nsecs / 1e3 / tm.calls,
+	    tm.max_nsecs / 1e3);
+	for (b = 0; b < MKTEMP_HIST_BUCKETS; b++) {
+		if (tm.hist[b] == 0)
+			continue;
+		(void)fprintf(stderr, "%s: %12.3f us and up: %lu\n",
+		    __progname, b ? (1ULL << b) / 1e3 : 0.0, tm.hist[b]);
+	}
+#endif
+}
+
+/*
+ * Write out a worker's pending names.  Each flush is a single chunk
+ * of whole names so output from concurrent workers never interleaves
+ * mid-name.
+ */
+static int
+flush_worker(w)
+	struct worker *w;
+{
+	ssize_t nwritten;
+	size_t off = 0;
+	int rval = 0;
+
+	if (w->outlen == 0)
+		return (0);
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_lock(&outlock);
+#endif
+	while (off < w->outlen) {
+		nwritten = write(STDOUT_FILENO, w->out + off, w->outlen - off);
+		if (nwritten == -1) {
+			if (errno == EINTR)
+				continue;
+			w->error = errno;
+			w->werror = 1;
+			rval = -1;
+			break;
+		}
+		off += nwritten;
+	}
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_unlock(&outlock);
+#endif
+	w->outlen = 0;
+	return (rval);
+}
+
+/*
+ * Create one entry from the batch template in w->path, or take it
+ * from the reservoir.  If fdp is not NULL it is set to a descriptor
+ * for the new entry (directories are opened read-only), otherwise
+ * nothing is left open.
+ */
+static int
+create_entry(w, fdp)
+	struct worker *w;
+	int *fdp;
+{
+	struct batch *b = w->batch;
+	int fd = -1, serrno;
+
+	fill_name(b, w->path + (b->prefix ? b->plen + 1 : 0));
+	w->unnamed = 0;
+#ifdef PRIV_MKTEMP
+	if (b->memfd) {
+		if ((fd = mktemp_memfd(w->path, 0, b->seals, &w->ctx)) == -1)
+			return (-1);
+	} else if (b->rfd != -1 && mktemp_reservoir_claim(b->rfd, b->dfd,
+	    RELPATH(w), 0, b->makedir, b->rmode, &w->ctx) == 0) {
+		/* Staged files still need provisioning. */
+		if (b->makedir) {
+			if (fdp != NULL && (fd = OPEN_W(w, O_RDONLY)) == -1)
+				goto bad;
+		} else if (fdp != NULL || b->oflags != 0 || b->size != 0 ||
+		    b->advice != 0 || b->provision != 0) {
+			if ((fd = OPEN_W(w, O_RDWR|b->oflags)) == -1 ||
+			    mktemp_provision(fd, &w->ctx) != 0)
+				goto bad;
+		}
+	} else
+#endif
+	if (b->makedir) {
+		if (MKDTEMP_W(w) == NULL)
+			return (-1);
+		if (fdp != NULL && (fd = OPEN_W(w, O_RDONLY)) == -1)
+			goto bad;
+	} else {
+#ifdef PRIV_MKTEMP
+		if (b->anon)
+			fd = mkstemp_anon(w);
+		else
+#endif
+			fd = MKSTEMP_W(w);
+		if (fd < 0)
+			return (-1);
+	}
+	if (b->srcfd != -1 && CLONE_W(w, fd) != 0)
+		goto bad;
+	if (b->uflag && !b->memfd && !w->unnamed) {
+		if (b->makedir)
+			(void)RMDIR_W(w);
+		else
+			(void)UNLINK_W(w);
+	}
+	if (fdp != NULL)
+		*fdp = fd;
+	else if (fd != -1)
+		(void)close(fd);
+	return (0);
+
+bad:
+	serrno = errno;
+	if (fd != -1)
+		(void)close(fd);
+	if (b->makedir)
+		(void)RMDIR_W(w);
+	else if (!w->unnamed)
+		(void)UNLINK_W(w);
+	errno = serrno;
+	return (-1);
+}
+
+/*
+ * Create w->count entries from the batch template, buffering the
+ * resulting names.  On failure, w->error is set and w->path holds
+ * the name that could not be created.
+ */
+static void *
+run_worker(arg)
+	void *arg;
+{
+	struct worker *w = (struct worker *)arg;
+	struct batch *b = w->batch;
+	unsigned long n;
+	size_t len;
+
+	len = (b->prefix ? b->plen + 1 : 0) + NAMELEN(b) + 1;
+	w->path = make_path(b, NULL);
+	w->out = (char *)malloc(WORKER_OUTSIZE);
+	if (w->path == NULL || w->out == NULL) {
+		w->error = errno;
+		return (NULL);
+	}
+
+#ifdef PRIV_MKTEMP
+	/* A reservoir, -a or a clone means one at a time. */
+	if (b->bsize > 1 && w->count > 1 && b->rfd == -1 && !b->anon &&
+	    b->srcfd == -1 &&
+	    run_batch(w, len) == 0) {
+		(void)flush_worker(w);
+		return (NULL);
+	}
+#endif
+
+	for (n = 0; n < w->count; n++) {
+		if (create_entry(w, NULL) != 0) {
+			w->error = errno;
+			break;
+		}
+
+		w->created++;
+
+		if (w->outlen + len > WORKER_OUTSIZE &&
+		    flush_worker(w) != 0)
+			return (NULL);
+		(void)memcpy(w->out + w->outlen, w->path, len - 1);
+		w->outlen += len - 1;
+		w->out[w->outlen++] = b->delim;
+	}
+
+	/* Report the entries we did create so the caller can remove them. */
+	(void)flush_worker(w);
+	return (NULL);
+}
+
+/*
+ * Create the one entry for -e and run the command on it, which gets
+ * a descriptor for it too.  A file in memory is only reachable through
+ * that descriptor.  Returns the exit value for mktemp.
+ */
+static int
+run_command(w, argv, quiet)
+	struct worker *w;
+	char **argv;
+	int quiet;
+{
+	struct batch *b = w->batch;
+	char procpath[64];
+	int fd;
+
+	if ((w->path = make_path(b, NULL)) == NULL) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: cannot allocate memory\n",
+			    __progname);
+		return (1);
+	}
+	if (create_entry(w, &fd) != 0) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: cannot %s %s: %s\n",
+			    __progname, b->makedir ?
+			    "make temp dir" : "create temp file",
+			    w->path, strerror(errno));
+		return (1);
+	}
+	if (b->memfd || w->unnamed) {
+		(void)snprintf(procpath, sizeof(procpath), "/proc/self/fd/%d",
+		    fd);
+		return (run_exec(procpath, fd, 0, EXEC_PASSFD, argv));
+	}
+	return (run_exec(w->path, fd, b->makedir,
+	    b->uflag ? 0 : EXEC_CLEANUP, argv));
+}
+
+#ifdef PRIV_MKTEMP
+/*
+ * The body of run_worker() for creating up to b->bsize entries at a
+ * time with mktemp_batchat(), which hands them to the kernel together
+ * where it can.  Returns -1, having done nothing, if the buffers for
+ * that many paths cannot be allocated.
+ */
+static int
+run_batch(w, len)
+	struct worker *w;
+	size_t len;
+{
+	struct batch *b = w->batch;
+	unsigned long n, want;
+	char **paths, *bufs, *path = w->path;
+	int i, got;
+
+	want = w->count < b->bsize ? w->count : b->bsize;
+	if (want > INT_MAX)
+		want = INT_MAX;
+	paths = (char **)malloc(want * sizeof(char *));
+	bufs = (char *)malloc(want * len);
+	if (paths == NULL || bufs == NULL) {
+		free(paths);
+		free(bufs);
+		return (-1);
+	}
+
+	for (n = 0; n < w->count; n += got) {
+		if (w->count - n < want)
+			want = w->count - n;
+		for (i = 0; (unsigned long)i < want; i++) {
+			(void)memcpy(bufs + i * len, path, len);
+			paths[i] = bufs + i * len + b->roff;
+		}
+		got = mktemp_batchat(b->dfd, paths, (int)want, 0, b->oflags,
+		    b->makedir ? S_IRWXU : S_IRUSR|S_IWUSR, b->makedir, NULL,
+		    &w->ctx);
+		if (got == -1)
+			got = 0;
+		for (i = 0; i < got; i++) {
+			/* The unlink macros work on w->path. */
+			w->path = paths[i] - b->roff;
+			if (b->uflag) {
+				if (b->makedir)
+					(void)RMDIR_W(w);
+				else
+					(void)UNLINK_W(w);
+			}
+			w->created++;
+
+			if (w->outlen + len > WORKER_OUTSIZE &&
+			    flush_worker(w) != 0)
+				break;
+			(void)memcpy(w->out + w->outlen, w->path, len - 1);
+			w->outlen += len - 1;
+			w->out[w->outlen++] = b->delim;
+		}
+		w->path = path;
+		if (w->werror)
+			break;
+		if ((unsigned long)got < want) {
+			w->error = errno;
+			/* Report the entry that could not be created. */
+			(void)memcpy(w->path, paths[got] - b->roff, len);
+			break;
+		}
+	}
+	free(paths);
+	free(bufs);
+	return (0);
+}
+#endif /* PRIV_MKTEMP */
+
+/*
+ * Broker worker: accept clients and hand each the entries it asks
+ * for, descriptor and all.  Every worker accepts connections itself
+ * so its random number stream and context stay warm between clients.
+ * Only returns if the listening socket fails.
+ */
+static void *
+serve_worker(arg)
+	void *arg;
+{
+	struct worker *w = (struct worker *)arg;
+	struct batch *b = w->batch;
+	unsigned long n;
+	int sock, fd;
+
+	if ((w->path = make_path(b, NULL)) == NULL) {
+		w->error = errno;
+		return (NULL);
+	}
+
+	for (;;) {
+		if ((sock = mktemp_broker_accept(b->lsock)) == -1) {
+			if (errno == EINTR || errno == ECONNABORTED ||
+			    errno == EPERM)
+				continue;
+			w->error = errno;
+			w->werror = 1;
+			break;
+		}
+		while ((n = mktemp_broker_getreq(sock)) != 0) {
+			for (; n != 0; n--) {
+				if (create_entry(w, &fd) != 0) {
+					(void)mktemp_broker_send(sock, -1,
+					    NULL, errno);
+					break;
+				}
+				if (mktemp_broker_send(sock, fd, w->path,
+				    0) != 0) {
+					/* Client gone, don't leave litter. */
+					if (!b->uflag && !b->memfd) {
+						if (b->makedir)
+							(void)RMDIR_W(w);
+						else
+							(void)UNLINK_W(w);
+					}
+					(void)close(fd);
+					goto done;
+				}
+				(void)close(fd);
+				w->created++;
+			}
+#ifdef PRIV_MKTEMP
+			if (b->rfd != -1)
+				refill(b, 0);
+#endif
+		}
+done:
+		(void)close(sock);
+	}
+	return (NULL);
+}
+
+/*
+ * Fetch count entries from a broker and print their names.  The
+ * descriptors are of no use once we exit, so they are just closed.
+ */
+static int
+run_client(sockpath, count, delim, quiet)
+	const char *sockpath;
+	unsigned long count;
+	int delim;
+	int quiet;
+{
+	char path[PATH_MAX];
+	int sock, fd;
+
+	if ((sock = mktemp_broker_connect(sockpath)) == -1 ||
+	    mktemp_broker_request(sock, count) != 0) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: cannot connect to %s: %s\n",
+			    __progname, sockpath, strerror(errno));
+		return (1);
+	}
+	while (count-- != 0) {
+		if ((fd = mktemp_broker_recv(sock, path,
+		    sizeof(path))) == -1) {
+			if (!quiet)
+				(void)fprintf(stderr, "%s: %s: %s\n",
+				    __progname, sockpath, strerror(errno));
+			(void)fflush(stdout);
+			return (1);
+		}
+		(void)close(fd);
+		(void)fputs(path, stdout);
+		(void)putchar(delim);
+	}
+	if (fflush(stdout) == EOF) {
+		if (!quiet)
+			(void)fprintf(stderr, "%s: write error: %s\n",
+			    __progname, strerror(errno));
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Remove the broker's socket on the way out.
+ */
+static void
+broker_quit(signo)
+	int signo;
+{
+	(void)signo;
+	(void)unlink(broker_path);
+	_exit(0);
 }
 
 void
@@ -211,7 +2047,14 @@ usage()
 {
 
 	(void)fprintf(stderr,
-	    "Usage: %s [-V] | [-dqtu] [-p prefix] [template]\n",
-	    __progname);
+	    "Usage: %s [-V] | [-Macdiqstuz] [-A alphabet] [-B size]\n"
+	    "              [-D socket] [-F levels] [-f file] [-j jobs]\n"
+	    "              [-k skeleton] [-N node] [-n count] [-o hints]\n"
+	    "              [-P policy] [-p prefix] [-R [low:]high] [-r age]\n"
+	    "              [-S size] [template]\n"
+	    "       %s -e [-Mdqtu] [-A alphabet] [-f file] [-k skeleton]\n"
+	    "              [-p prefix] [template] -- command [argument ...]\n"
+	    "       %s -C socket [-qz] [-n count]\n",
+	    __progname, __progname, __progname);
 	exit(1);
 }
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Placement of entries across several candidate directories.
+ *
+ * Each candidate is looked at once with stat(2) and statfs(2) (or
+ * statvfs(3)); after that deciding where each entry of a batch goes
+ * is simple arithmetic.  Candidates that are not usable directories,
+ * or that live on the same device as an earlier candidate, get no
+ * entries so that a batch is spread over distinct devices.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_VFS_H
+# include <sys/vfs.h>
+#endif
+#ifdef HAVE_SYS_STATVFS_H
+# include <sys/statvfs.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif /* HAVE_STRINGS_H */
+#endif /* HAVE_STRING_H */
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+#include <errno.h>
+
+#include <extern.h>
+
+#ifndef TMPFS_MAGIC
+# define TMPFS_MAGIC	0x01021994
+#endif
+
+/* Files no bigger than this are "small" for PLACE_TMPFS. */
+#define PLACE_SMALL	(1024 * 1024)
+
+struct cand {
+	unsigned long long avail;	/* bytes free for unprivileged use */
+	long long current;		/* smooth weighted round-robin state */
+	unsigned long weight;		/* avail in MiB, at least 1 */
+	int usable;
+	int tmpfs;
+};
+
+static const char *policies[] = {
+	"space", "tmpfs", "rr", "hash", NULL
+};
+
+int
+place_policy(name)
+	const char *name;
+{
+	int i;
+
+	for (i = 0; policies[i] != NULL; i++) {
+		if (strcmp(name, policies[i]) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+static void
+examine(dir, c)
+	const char *dir;
+	struct cand *c;
+{
+#ifdef HAVE_STATVFS
+	struct statvfs svfs;
+#endif
+#if defined(HAVE_STATFS) && defined(HAVE_SYS_VFS_H)
+	struct statfs sfs;
+#endif
+
+	c->usable = 1;
+#ifdef HAVE_STATVFS
+	if (statvfs(dir, &svfs) == 0)
+		c->avail = (unsigned long long)svfs.f_bavail * svfs.f_frsize;
+	else
+		c->usable = 0;
+#endif
+#if defined(HAVE_STATFS) && defined(HAVE_SYS_VFS_H)
+	if (statfs(dir, &sfs) == 0) {
+		c->tmpfs = sfs.f_type == TMPFS_MAGIC;
+# ifndef HAVE_STATVFS
+		c->avail = (unsigned long long)sfs.f_bavail * sfs.f_bsize;
+# endif
+	} else
+		c->usable = 0;
+#endif
+	c->weight = c->avail >> 20 ? c->avail >> 20 : 1;
+	if (c->weight > 0x7fffffffUL)
+		c->weight = 0x7fffffffUL;
+}
+
+/*
+ * Pick the next candidate among those for which want[] is set by smooth
+ * weighted round-robin on free space, so the first pick is the one with
+ * the most room and a batch is spread in proportion to it.
+ */
+static int
+pick_space(cands, want, n)
+	struct cand *cands;
+	int *want;
+	int n;
+{
+	long long total = 0;
+	int i, best = -1;
+
+	for (i = 0; i < n; i++) {
+		if (!want[i])
+			continue;
+		cands[i].current += cands[i].weight;
+		total += cands[i].weight;
+		if (best == -1 || cands[i].current > cands[best].current)
+			best = i;
+	}
+	if (best != -1)
+		cands[best].current -= total;
+	return (best);
+}
+
+/*
+ * Work out how many of count entries go in each of the n directories,
+ * storing the result in counts[].  The template is only used to seed
+ * PLACE_HASH.  Returns the number of directories that get entries; if
+ * none is usable, everything goes in the first one so that the usual
+ * error is reported.
+ */
+int
+place_entries(dirs, n, policy, template, count, size, makedir, counts)
+	char **dirs;
+	int n;
+	int policy;
+	const char *template;
+	unsigned long count;
+	off_t size;
+	int makedir;
+	unsigned long *counts;
+{
+	struct cand *cands;
+	struct stat sb;
+	dev_t *devs;
+	unsigned long e, h;
+	const char *cp;
+	int *want, *small, i, j, nusable = 0, used = 0, next;
+
+	cands = (struct cand *)calloc(n, sizeof(*cands));
+	devs = (dev_t *)calloc(n, sizeof(*devs));
+	want = (int *)calloc(n, sizeof(*want));
+	small = (int *)calloc(n, sizeof(*small));
+	if (cands == NULL || devs == NULL || want == NULL || small == NULL) {
+		free(cands);
+		free(devs);
+		free(want);
+		free(small);
+		return (-1);
+	}
+
+	for (i = 0; i < n; i++) {
+		counts[i] = 0;
+		if (stat(dirs[i], &sb) != 0 || !S_ISDIR(sb.st_mode) ||
+		    access(dirs[i], W_OK|X_OK) != 0)
+			continue;
+		devs[i] = sb.st_dev;
+		for (j = 0; j < i; j++) {
+			if (cands[j].usable && devs[j] == sb.st_dev)
+				break;
+		}
+		if (j != i)
+			continue;
+		examine(dirs[i], &cands[i]);
+		/* Skip directories that cannot hold even one entry. */
+		if (cands[i].usable &&
+		    (unsigned long long)size > cands[i].avail)
+			cands[i].usable = 0;
+		if (cands[i].usable)
+			nusable++;
+	}
+	if (nusable == 0) {
+		counts[0] = count;
+		goto done;
+	}
+
+	switch (policy) {
+	case PLACE_TMPFS:
+		/* Small files go to tmpfs if there is one, others to disk. */
+		for (i = 0; i < n; i++) {
+			small[i] = cands[i].usable && cands[i].tmpfs;
+			want[i] = cands[i].usable && !cands[i].tmpfs;
+			if (small[i])
+				used++;
+		}
+		if (used != 0 && !makedir && size <= PLACE_SMALL) {
+			for (e = 0; e < count; e++)
+				counts[pick_space(cands, small, n)]++;
+			break;
+		}
+		for (i = 0, used = 0; i < n; i++)
+			used += want[i];
+		if (used == 0) {
+			for (i = 0; i < n; i++)
+				want[i] = cands[i].usable;
+		}
+		for (e = 0; e < count; e++)
+			counts[pick_space(cands, want, n)]++;
+		break;
+	case PLACE_RR:
+	case PLACE_HASH:
+		/*
+		 * Deal entries out in turn.  Round-robin starts from our
+		 * process ID so separate runs spread out; hash starts from
+		 * the template so each kind of entry has a home device.
+		 */
+		if (policy == PLACE_RR)
+			h = (unsigned long)getpid();
+		else {
+			for (h = 2166136261UL, cp = template; *cp; cp++)
+				h = (h ^ (unsigned char)*cp) * 16777619UL;
+		}
+		next = (int)(h % nusable);
+		for (i = 0; i < n && next >= 0; i++) {
+			if (cands[i].usable && next-- == 0)
+				break;
+		}
+		for (e = 0; e < count; e++) {
+			counts[i]++;
+			do {
+				i = (i + 1) % n;
+			} while (!cands[i].usable);
+		}
+		break;
+	default:
+		for (i = 0; i < n; i++)
+			want[i] = cands[i].usable;
+		for (e = 0; e < count; e++)
+			counts[pick_space(cands, want, n)]++;
+		break;
+	}
+
+done:
+	for (i = 0, used = 0; i < n; i++) {
+		if (counts[i] != 0)
+			used++;
+	}
+	free(cands);
+	free(devs);
+	free(want);
+	free(small);
+	return (used);
+}
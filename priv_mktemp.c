@@ -19,6 +19,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -26,81 +27,1506 @@
 #ifdef HAVE_STDLIB_H
 # include <stdlib.h>
 #endif /* HAVE_STDLIB_H */
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif /* HAVE_STRINGS_H */
+#endif /* HAVE_STRING_H */
 #include <ctype.h>
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
 #endif /* HAVE_UNISTD_H */
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#ifdef HAVE_FLOCK
+# include <sys/file.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+#ifdef HAVE_IO_URING
+# include <linux/io_uring.h>
+#endif
+#ifdef HAVE_MEMFD_CREATE
+# include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+# include <time.h>
+#else
+# include <sys/time.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
 
 #include <extern.h>
 
 #define MKTEMP_FILE	1
 #define MKTEMP_DIR	2
+#define MKTEMP_LINK	3
+#define MKTEMP_RENAME	4
+
+/* Open flags callers may add, as for OpenBSD's mkostemps(3). */
+#ifndef O_CLOEXEC
+# define O_CLOEXEC	0
+#endif
+#ifndef O_DIRECT
+# define O_DIRECT	0
+#endif
+#ifndef O_DSYNC
+# define O_DSYNC	0
+#endif
+#ifndef O_NOATIME
+# define O_NOATIME	0
+#endif
+#ifndef O_RSYNC
+# define O_RSYNC	0
+#endif
+#define MKOTEMP_FLAGS \
+	(O_APPEND | O_CLOEXEC | O_DIRECT | O_DSYNC | O_NOATIME | O_RSYNC | \
+	    O_SYNC)
+
+#define TEMPCHARS	MKTEMP_ALNUM
+#define NUM_CHARS	(sizeof(TEMPCHARS) - 1)
+
+/*
+ * The characters a suffix is made of.  When there is a power of two of
+ * them, each takes bits bits of a random word.
+ */
+struct alphabet {
+	const char *chars;
+	unsigned int n;		/* number of characters */
+	unsigned int bits;	/* log2(n) if a power of two, else 0 */
+};
+
+#ifdef WIN32
+# define mkdir(_path, _mode)	_mkdir(_path)
+#endif
+
+/* Without the *at() functions the only directory fd is AT_FDCWD. */
+#ifndef HAVE_OPENAT
+# define openat(_dfd, _path, _flags, _mode)	open(_path, _flags, _mode)
+#endif
+#ifndef HAVE_MKDIRAT
+# define mkdirat(_dfd, _path, _mode)		mkdir(_path, _mode)
+#endif
+#ifndef HAVE_UNLINKAT
+# define unlinkat(_dfd, _path, _flag)		unlink(_path)
+#endif
+#ifndef HAVE_FSTATAT
+# define fstatat(_dfd, _path, _sb, _flag)	stat(_path, _sb)
+#endif
+#ifndef HAVE_FCHMODAT
+# define fchmodat(_dfd, _path, _mode, _flag)	chmod(_path, _mode)
+#endif
+
+#ifndef INT_MAX
+#define INT_MAX	0x7fffffff
+#endif
+
+#ifndef RENAME_NOREPLACE
+# define RENAME_NOREPLACE	(1 << 0)
+#endif
+
+#define SUFFIX_WORDS	8	/* 64-bit words drawn at a time */
+
+#define BATCH_MAX	64	/* creations in flight at once */
+#define BATCH_CLOSE	(~0ULL)	/* user data of a close */
+
+/*
+ * Set of the suffixes already present in a directory for a given
+ * template prefix, so candidates can be rejected without a system
+ * call.  Suffixes are stored as 64-bit hashes in an open-addressed
+ * table; a false match merely skips a free name.  Names we create are
+ * added as we go.  The index may be shared between threads.
+ */
+struct mktemp_index {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	uint64_t *slots;	/* hashes, 0 means empty */
+	size_t mask;		/* number of slots - 1 */
+	size_t count;		/* suffixes in the set */
+	size_t space;		/* possible suffixes (saturates) */
+	size_t xlen;		/* suffix length the index was built for */
+};
+
+/*
+ * Names from a counter: each value is encrypted with a random key by
+ * a Feistel network, with SipHash-2-4 as the round function, over the
+ * smallest even number of bits that holds n ** xlen values, for an
+ * alphabet of n characters.  Results outside that range are encrypted
+ * again ("cycle walking"), which keeps it a permutation, so distinct
+ * counter values can never give the same name.  Only as many Xs as
+ * keep that below SEQ_LIMIT (ten of the default 62 characters) are
+ * done this way; any others are random.
+ */
+#define SEQ_LIMIT	((uint64_t)1 << 62)
+#define SEQ_ROUNDS	4
+
+struct mktemp_seq {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	uint64_t key[2];
+	uint64_t next;		/* counter value for the next name */
+};
+
+#ifdef HAVE_PTHREAD
+# define INDEX_LOCK(idx)	pthread_mutex_lock(&(idx)->lock)
+# define INDEX_UNLOCK(idx)	pthread_mutex_unlock(&(idx)->lock)
+#else
+# define INDEX_LOCK(idx)
+# define INDEX_UNLOCK(idx)
+#endif
+
+static uint64_t
+index_hash(cp, n)
+	const char *cp;
+	size_t n;
+{
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+
+	while (n--) {
+		h ^= (unsigned char)*cp++;
+		h *= 0x100000001b3ULL;
+	}
+	return (h ? h : 1);
+}
+
+static int
+index_lookup(idx, cp, n)
+	struct mktemp_index *idx;
+	const char *cp;
+	size_t n;
+{
+	uint64_t h = index_hash(cp, n);
+	size_t i;
+
+	for (i = h & idx->mask; idx->slots[i] != 0; i = (i + 1) & idx->mask) {
+		if (idx->slots[i] == h)
+			return (1);
+	}
+	return (0);
+}
+
+static int
+index_insert(idx, h)
+	struct mktemp_index *idx;
+	uint64_t h;
+{
+	uint64_t *oslots;
+	size_t i, omask;
+
+	/* Keep the table at most half full. */
+	if ((idx->count + 1) * 2 > idx->mask + 1) {
+		oslots = idx->slots;
+		omask = idx->mask;
+		idx->mask = omask * 2 + 1;
+		idx->slots = (uint64_t *)calloc(idx->mask + 1,
+		    sizeof(uint64_t));
+		if (idx->slots == NULL) {
+			idx->slots = oslots;
+			idx->mask = omask;
+			return (-1);
+		}
+		idx->count = 0;
+		for (i = 0; i <= omask; i++) {
+			if (oslots[i] != 0)
+				(void)index_insert(idx, oslots[i]);
+		}
+		free(oslots);
+	}
+	for (i = h & idx->mask; idx->slots[i] != 0; i = (i + 1) & idx->mask) {
+		if (idx->slots[i] == h)
+			return (0);
+	}
+	idx->slots[i] = h;
+	idx->count++;
+	return (0);
+}
+
+/*
+ * Return a copy of the directory part of path, base being the start
+ * of the last component.
+ */
+static char *
+template_dir(path, base)
+	const char *path;
+	const char *base;
+{
+	char *dir;
+
+	if (base == path)
+		return (strdup("."));
+	if (base - 1 == path)
+		return (strdup("/"));
+	if ((dir = (char *)malloc((size_t)(base - path))) != NULL) {
+		(void)memcpy(dir, path, (size_t)(base - path - 1));
+		dir[base - path - 1] = '\0';
+	}
+	return (dir);
+}
+
+/*
+ * Look up the alphabet a context asks for, which must be usable in
+ * names; '.' is not, with fan-out, as ".." would then be a fan-out
+ * directory.
+ */
+static int
+get_alphabet(ctx, levels, ab)
+	const struct mktemp_ctx *ctx;
+	int levels;
+	struct alphabet *ab;
+{
+	unsigned char seen[256 / 8];
+	const unsigned char *cp;
+
+	ab->chars = TEMPCHARS;
+	ab->n = NUM_CHARS;
+	ab->bits = 0;
+	if (ctx == NULL || ctx->alphabet == NULL)
+		return (0);
+
+	(void)memset(seen, 0, sizeof(seen));
+	for (cp = (const unsigned char *)ctx->alphabet; *cp != '\0'; cp++) {
+		if (*cp == '/' || (*cp == '.' && levels != 0) ||
+		    (seen[*cp / 8] & (1 << (*cp % 8))) != 0) {
+			errno = EINVAL;
+			return (-1);
+		}
+		seen[*cp / 8] |= 1 << (*cp % 8);
+	}
+	ab->chars = ctx->alphabet;
+	ab->n = (unsigned int)(cp - (const unsigned char *)ctx->alphabet);
+	if (ab->n < 2) {
+		errno = EINVAL;
+		return (-1);
+	}
+	while ((1U << ab->bits) < ab->n)
+		ab->bits++;
+	if ((1U << ab->bits) != ab->n)
+		ab->bits = 0;
+	return (0);
+}
+
+/*
+ * Replace the n characters at cp with random ones from the alphabet
+ * using a single arc4random_buf() call for the common case.
+ *
+ * With a power of two characters, each is simply the next few bits of
+ * a 64-bit word.  Otherwise, as many digits as fit are taken from each
+ * word: it is reduced modulo ab->n ** digits, after rejecting the few
+ * values at or above the largest multiple of that so that every digit
+ * is uniformly distributed.  For the default 62 characters that is ten
+ * digits per word with a rejection rate of under 5%.
+ *
+ * Returns the number of random bytes used.
+ */
+static size_t
+fill_suffix(ab, cp, n)
+	const struct alphabet *ab;
+	char *cp;
+	size_t n;
+{
+	uint64_t words[SUFFIX_WORDS], w, pow = 0, limit = 0, mask = ab->n - 1;
+	size_t i, nwords, digits, ndigits, used = 0;
+
+	if (ab->bits != 0)
+		digits = 64 / ab->bits;
+	else {
+		for (pow = 1, digits = 0; pow <= UINT64_MAX / ab->n; digits++)
+			pow *= ab->n;
+		limit = (UINT64_MAX / pow) * pow;
+	}
+
+	while (n > 0) {
+		nwords = (n + digits - 1) / digits;
+		if (nwords > SUFFIX_WORDS)
+			nwords = SUFFIX_WORDS;
+		arc4random_buf(words, nwords * sizeof(words[0]));
+		used += nwords * sizeof(words[0]);
+		for (i = 0; i < nwords; i++) {
+			w = words[i];
+			ndigits = n < digits ? n : digits;
+			n -= ndigits;
+			if (ab->bits != 0) {
+				while (ndigits--) {
+					*cp++ = ab->chars[w & mask];
+					w >>= ab->bits;
+				}
+				continue;
+			}
+			while (w >= limit) {
+				arc4random_buf(&w, sizeof(w));
+				used += sizeof(w);
+			}
+			w %= pow;
+			while (ndigits--) {
+				*cp++ = ab->chars[w % ab->n];
+				w /= ab->n;
+			}
+		}
+	}
+	return (used);
+}
+
+#define ROTL(x, b)	(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND(v0, v1, v2, v3) do {					\
+	v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);	\
+	v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;				\
+	v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;				\
+	v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);	\
+} while (0)
+
+/*
+ * SipHash-2-4 of the single 64-bit word m.
+ */
+static uint64_t
+siphash(key, m)
+	const uint64_t *key;
+	uint64_t m;
+{
+	uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+	uint64_t b = (uint64_t)8 << 56;
+
+	v3 ^= m;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= m;
+	v3 ^= b;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	return (v0 ^ v1 ^ v2 ^ v3);
+}
+
+struct mktemp_seq *
+mktemp_seq_create()
+{
+	struct mktemp_seq *seq;
+
+	if ((seq = (struct mktemp_seq *)calloc(1, sizeof(*seq))) == NULL)
+		return (NULL);
+	arc4random_buf(seq->key, sizeof(seq->key));
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_init(&seq->lock, NULL);
+#endif
+	return (seq);
+}
+
+void
+mktemp_seq_free(seq)
+	struct mktemp_seq *seq;
+{
+	if (seq != NULL) {
+#ifdef HAVE_PTHREAD
+		(void)pthread_mutex_destroy(&seq->lock);
+#endif
+		free(seq);
+	}
+}
+
+/*
+ * Fill in up to n characters at cp with the next name of the sequence
+ * and return how many.  Returns -1 once the counter has used up every
+ * name of that length.
+ */
+static int
+seq_suffix(seq, ab, cp, n)
+	struct mktemp_seq *seq;
+	const struct alphabet *ab;
+	char *cp;
+	size_t n;
+{
+	uint64_t c, x, l, r, limit, mask;
+	unsigned int bits, half, i;
+
+	for (limit = 1, i = 0; i < n && limit <= SEQ_LIMIT / ab->n; i++)
+		limit *= ab->n;
+	n = i;
+	for (bits = 2; bits < 64 && ((uint64_t)1 << bits) < limit; bits += 2)
+		continue;
+	half = bits / 2;
+	mask = ((uint64_t)1 << half) - 1;
+
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_lock(&seq->lock);
+#endif
+	c = seq->next;
+	if (c < limit)
+		seq->next++;
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_unlock(&seq->lock);
+#endif
+	if (c >= limit)
+		return (-1);
+
+	x = c;
+	do {
+		l = x >> half;
+		r = x & mask;
+		for (i = 0; i < SEQ_ROUNDS; i++) {
+			c = l ^ (siphash(seq->key, r | (uint64_t)bits << 48 |
+			    (uint64_t)i << 56) & mask);
+			l = r;
+			r = c;
+		}
+		x = l << half | r;
+	} while (x >= limit);
+
+	for (i = 0; i < n; i++) {
+		if (ab->bits != 0) {
+			cp[i] = ab->chars[x & (ab->n - 1)];
+			x >>= ab->bits;
+		} else {
+			cp[i] = ab->chars[x % ab->n];
+			x /= ab->n;
+		}
+	}
+	return ((int)n);
+}
+
+/*
+ * Pick the characters for the Xs: from the context's sequence if it
+ * has one, otherwise at random.  Either way, ctx counts the random
+ * bytes used.
+ */
+static void
+next_suffix(ctx, ab, cp, n)
+	struct mktemp_ctx *ctx;
+	const struct alphabet *ab;
+	char *cp;
+	size_t n;
+{
+	size_t used = 0;
+	int done = 0;
+
+	if (ctx != NULL && ctx->seq != NULL &&
+	    (done = seq_suffix(ctx->seq, ab, cp, n)) == -1)
+		done = 0;
+	if ((size_t)done < n)
+		used = fill_suffix(ab, cp + done, n - (size_t)done);
+	if (ctx != NULL)
+		ctx->rngbytes += used;
+}
+
+/*
+ * Step the characters for the Xs on to the next name, as an odometer
+ * would, wrapping around after the last one.
+ */
+static void
+step_suffix(ab, cp, n)
+	const struct alphabet *ab;
+	char *cp;
+	size_t n;
+{
+	const char *p;
+
+	while (n--) {
+		p = strchr(ab->chars, cp[n]);
+		if (p != NULL && (unsigned int)(p - ab->chars) + 1 < ab->n) {
+			cp[n] = p[1];
+			return;
+		}
+		cp[n] = ab->chars[0];
+	}
+}
+
+/*
+ * Timing of creation system calls, for mktemp -s.  Callers only pay
+ * for it when ctx->timing is set.
+ */
+static unsigned long long
+timing_now()
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+	struct timeval tv;
+
+	(void)gettimeofday(&tv, NULL);
+	return ((unsigned long long)tv.tv_sec * 1000000000ULL +
+	    tv.tv_usec * 1000ULL);
+#endif
+}
+
+static void
+timing_add(tm, start)
+	struct mktemp_timing *tm;
+	unsigned long long start;
+{
+	unsigned long long ns = timing_now() - start;
+	int b;
+
+	tm->calls++;
+	tm->nsecs += ns;
+	if (ns > tm->max_nsecs)
+		tm->max_nsecs = ns;
+	for (b = 0; b < MKTEMP_HIST_BUCKETS - 1 && (ns >> (b + 1)) != 0; b++)
+		continue;
+	tm->hist[b]++;
+}
+
+/*
+ * Give the unnamed file fd the name path, relative to dfd.  Linking
+ * through /proc works for ordinary users; AT_EMPTY_PATH needs
+ * CAP_DAC_READ_SEARCH but does not depend on /proc being mounted.
+ */
+static int
+link_anon(fd, dfd, path)
+	int fd;
+	int dfd;
+	const char *path;
+{
+#if defined(HAVE_LINKAT) && defined(O_TMPFILE)
+	char procpath[64];
+
+# ifdef AT_EMPTY_PATH
+	if (linkat(fd, "", dfd, path, AT_EMPTY_PATH) == 0)
+		return (0);
+	if (errno != ENOENT)
+		return (-1);
+# endif
+	(void)snprintf(procpath, sizeof(procpath), "/proc/self/fd/%d", fd);
+	return (linkat(AT_FDCWD, procpath, dfd, path, AT_SYMLINK_FOLLOW));
+#else
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
+
+/*
+ * Ask btrfs not to copy-on-write the file (or, for a directory, files
+ * later created in it).  This only takes effect while a file is empty.
+ */
+static void
+set_nocow(fd)
+	int fd;
+{
+#if defined(FS_IOC_GETFLAGS) && defined(FS_NOCOW_FL)
+	int attr;
+
+	if (ioctl(fd, FS_IOC_GETFLAGS, &attr) == 0 &&
+	    (attr & FS_NOCOW_FL) == 0) {
+		attr |= FS_NOCOW_FL;
+		(void)ioctl(fd, FS_IOC_SETFLAGS, &attr);
+	}
+#endif
+}
+
+static int
+preallocate(fd, size)
+	int fd;
+	off_t size;
+{
+#ifdef HAVE_FALLOCATE
+	if (fallocate(fd, 0, 0, size) == 0)
+		return (0);
+	if (errno != EOPNOTSUPP && errno != ENOSYS)
+		return (-1);
+#endif
+#ifdef HAVE_POSIX_FALLOCATE
+	/* May be emulated by writing to each block, but still allocates. */
+	if ((errno = posix_fallocate(fd, 0, size)) == 0)
+		return (0);
+	if (errno != EOPNOTSUPP && errno != EINVAL)
+		return (-1);
+#endif
+	/* At least make it the right size. */
+	return (ftruncate(fd, size));
+}
+
+int
+mktemp_provision(fd, ctx)
+	int fd;
+	const struct mktemp_ctx *ctx;
+{
+	if (ctx == NULL)
+		return (0);
+	if (ctx->provision & MKTEMP_NOCOW)
+		set_nocow(fd);
+	if (ctx->size > 0 && preallocate(fd, ctx->size) != 0)
+		return (-1);
+#ifdef HAVE_POSIX_FADVISE
+	if (ctx->advice != 0)
+		(void)posix_fadvise(fd, 0, 0, ctx->advice);
+#endif
+	return (0);
+}
+
+/*
+ * Errors that mean a way of copying does not apply to these files, so
+ * the next should be tried.
+ */
+#define COPY_UNSUPPORTED(e) \
+	((e) == EINVAL || (e) == ENOSYS || (e) == EOPNOTSUPP || \
+	 (e) == EXDEV || (e) == ENOTTY || (e) == EBADF || (e) == ETXTBSY)
+
+#define COPY_BUFSIZ	(128 * 1024)
+
+int
+mktemp_clone(srcfd, fd, ctx)
+	int srcfd;
+	int fd;
+	struct mktemp_ctx *ctx;
+{
+	struct stat sb;
+	off_t off = 0;
+	ssize_t n = 0, nw, done;
+	char *buf;
+
+	if (fstat(srcfd, &sb) != 0)
+		return (-1);
+#ifdef FICLONE
+	if (ioctl(fd, FICLONE, srcfd) == 0) {
+		if (ctx != NULL)
+			ctx->reflinks++;
+		return (0);
+	}
+	if (!COPY_UNSUPPORTED(errno))
+		return (-1);
+#endif
+	/* Only regular files have a size to go by. */
+	if (S_ISREG(sb.st_mode)) {
+#ifdef HAVE_COPY_FILE_RANGE
+		while (off < sb.st_size) {
+			n = copy_file_range(srcfd, &off, fd, NULL,
+			    (size_t)(sb.st_size - off), 0);
+			if (n <= 0 && (n == 0 || errno != EINTR))
+				break;
+		}
+		if (n == -1 && !COPY_UNSUPPORTED(errno))
+			goto out;
+		n = 0;
+#endif
+#ifdef HAVE_SENDFILE
+		while (off < sb.st_size) {
+			n = sendfile(fd, srcfd, &off,
+			    (size_t)(sb.st_size - off));
+			if (n <= 0 && (n == 0 || errno != EINTR))
+				break;
+		}
+		if (n == -1 && !COPY_UNSUPPORTED(errno))
+			goto out;
+		n = 0;
+#endif
+		if (off >= sb.st_size)
+			goto out;
+	}
+
+	/* Read to the end, in case the file has grown meanwhile. */
+	if ((buf = (char *)malloc(COPY_BUFSIZ)) == NULL)
+		return (-1);
+	for (;;) {
+		if (S_ISREG(sb.st_mode))
+			n = pread(srcfd, buf, COPY_BUFSIZ, off);
+		else
+			n = read(srcfd, buf, COPY_BUFSIZ);
+		if (n == 0)
+			break;
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (done = 0; done < n; done += nw) {
+			if ((nw = write(fd, buf + done,
+			    (size_t)(n - done))) == -1) {
+				if (errno != EINTR)
+					break;
+				nw = 0;
+			}
+		}
+		if (done < n) {
+			n = -1;
+			break;
+		}
+		off += n;
+	}
+	free(buf);
+
+out:
+	if (ctx != NULL)
+		ctx->copied += off;
+	return (n == -1 ? -1 : 0);
+}
+
+/*
+ * Finish off a newly created entry.  O_DIRECT is only set once the
+ * file exists since some file systems refuse it, and we must not
+ * leave the file behind if they do.
+ */
+static int
+provision_entry(dfd, path, mode, flags, ctx, fd)
+	int dfd;
+	const char *path;
+	int mode;
+	int flags;
+	const struct mktemp_ctx *ctx;
+	int fd;
+{
+	int dirfd, oflags, serrno;
+
+	if (mode == MKTEMP_DIR) {
+		if (ctx != NULL && (ctx->provision & MKTEMP_NOCOW) &&
+		    (dirfd = openat(dfd, path, O_RDONLY, 0)) != -1) {
+			set_nocow(dirfd);
+			(void)close(dirfd);
+		}
+		return (fd);
+	}
+	if ((flags & O_DIRECT) != 0) {
+		if ((oflags = fcntl(fd, F_GETFL)) == -1 ||
+		    fcntl(fd, F_SETFL, oflags | O_DIRECT) == -1)
+			goto bad;
+	}
+	if (mktemp_provision(fd, ctx) != 0)
+		goto bad;
+	return (fd);
+
+bad:
+	serrno = errno;
+	(void)close(fd);
+	(void)unlinkat(dfd, path, 0);
+	errno = serrno;
+	return (-1);
+}
+
+/*
+ * Find the fan-out directories in path: levels components of two
+ * characters each just before the last one, whose Xs start at start.
+ * Returns a pointer to the first, or NULL if they are not there.
+ */
+static char *
+fanout_dirs(path, start, levels)
+	char *path;
+	char *start;
+	int levels;
+{
+	char *fan;
+	int i;
+
+	for (fan = start; fan > path && fan[-1] != '/'; fan--)
+		continue;
+	if (fan - path < 3 * levels)
+		return (NULL);
+	fan -= 3 * levels;
+	if (fan != path && fan[-1] != '/')
+		return (NULL);
+	for (i = 0; i < levels; i++) {
+		if (fan[3 * i] == '/' || fan[3 * i + 1] == '/' ||
+		    fan[3 * i + 2] != '/')
+			return (NULL);
+	}
+	return (fan);
+}
+
+/*
+ * The fan-out directories are named after the suffix.
+ */
+static void
+fill_fanout(fan, start, levels)
+	char *fan;
+	const char *start;
+	int levels;
+{
+	int i;
+
+	for (i = 0; i < levels; i++) {
+		fan[3 * i] = start[2 * i];
+		fan[3 * i + 1] = start[2 * i + 1];
+	}
+}
+
+/*
+ * Open the last of the fan-out directories at fan, relative to bfd,
+ * the directory the fan-out is in, making whichever are missing.  In a
+ * shared directory, sticky and world-writable like /tmp, they are made
+ * the same way so that every user can fan out into them; elsewhere
+ * they are private, mode 0700.  Each level is opened on its own,
+ * relative to the one above, without following symbolic links.  One
+ * that is already there may have been put there by anybody, so unless
+ * it is ours and nobody else can write to it, or it is sticky and
+ * world-writable, it is refused with EPERM, as is one we cannot read.
+ */
+static int
+open_fanout(bfd, fan, levels, shared)
+	int bfd;
+	char *fan;
+	int levels;
+	int shared;
+{
+	struct stat sb;
+	mode_t dmode;
+	char *cp;
+	int fd = bfd, nfd, i, tries, made, serrno;
+
+	dmode = shared ? S_ISVTX|S_IRWXU|S_IRWXG|S_IRWXO : S_IRWXU;
+	for (i = 0; i < levels; i++) {
+		cp = fan + 3 * i;
+		cp[2] = '\0';
+		made = 0;
+		/* Someone may be making (or removing) the same one. */
+		for (tries = 0;; tries++) {
+			nfd = openat(fd, cp,
+			    O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC, 0);
+			if (nfd != -1 || errno != ENOENT || tries == 2)
+				break;
+			if (mkdirat(fd, cp, dmode) == 0)
+				made = 1;
+			else if (errno != EEXIST)
+				break;
+		}
+		cp[2] = '/';
+		if (nfd == -1 && errno == EACCES)
+			errno = EPERM;
+		if (nfd != -1 && fstat(nfd, &sb) != 0) {
+			(void)close(nfd);
+			nfd = -1;
+		}
+		/* A shared level is for everyone, whatever our umask. */
+		if (nfd != -1 && made && shared && sb.st_uid == geteuid() &&
+		    (sb.st_mode & dmode) != dmode && fchmod(nfd, dmode) == 0)
+			sb.st_mode |= dmode;
+		if (nfd != -1 && !(sb.st_uid == geteuid() &&
+		    (sb.st_mode & (S_IWGRP|S_IWOTH)) == 0) &&
+		    (sb.st_mode & (S_ISVTX|S_IWOTH)) != (S_ISVTX|S_IWOTH)) {
+			(void)close(nfd);
+			nfd = -1;
+			errno = EPERM;
+		}
+		serrno = errno;
+		if (fd != bfd)
+			(void)close(fd);
+		if (nfd == -1) {
+			errno = serrno;
+			return (-1);
+		}
+		fd = nfd;
+	}
+	return (fd);
+}
+
+/*
+ * A node's namespace: the characters that end each of its names and
+ * the staging directory its entries are made in.  Names are unique
+ * within a node anyway, so the staged name is the final one.
+ */
+#define NODE_NAME	".mktemp-node.%llx.%lu"
+
+struct mktemp_node {
+	uint64_t id;		/* node number, or hash of its name */
+	int numbered;		/* id is a number, not a hash */
+	int sfd;		/* staging directory, or -1 */
+	int norename;		/* set once renameat2() is found wanting */
+};
+
+/*
+ * Spell out a node's characters in the given alphabet.  A node number
+ * that does not fit in them would share its characters with a lower
+ * one, so it is refused (ERANGE).
+ */
+static int
+node_tag(node, ab, cp)
+	const struct mktemp_node *node;
+	const struct alphabet *ab;
+	char *cp;
+{
+	uint64_t v = node->id, space = 1;
+	int i;
+
+	if (node->numbered) {
+		for (i = 0; i < MKTEMP_NODE_CHARS; i++)
+			space *= ab->n;
+		if (v >= space) {
+			errno = ERANGE;
+			return (-1);
+		}
+	}
+	for (i = 0; i < MKTEMP_NODE_CHARS; i++) {
+		*cp++ = ab->chars[v % ab->n];
+		v /= ab->n;
+	}
+	return (0);
+}
+
+/*
+ * FNV-1a, which every node computes alike whatever its byte order.
+ */
+static uint64_t
+node_hash(id)
+	const char *id;
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*id != '\0') {
+		h ^= (unsigned char)*id++;
+		h *= 0x100000001b3ULL;
+	}
+	return (h);
+}
+
+struct mktemp_node *
+mktemp_node_open(dfd, id)
+	int dfd;
+	const char *id;
+{
+	struct mktemp_node *node;
+	char host[256], name[sizeof(NODE_NAME) + 16 + 20];
+	uint64_t v;
+	const char *cp;
+#if defined(HAVE_OPENAT) && (defined(HAVE_RENAMEAT2) || defined(HAVE_LINKAT))
+	struct stat sb;
+	int serrno;
+#endif
+
+	if (id == NULL || *id == '\0') {
+		if (gethostname(host, sizeof(host)) != 0)
+			return (NULL);
+		host[sizeof(host) - 1] = '\0';
+		id = host;
+	}
+	if ((node = (struct mktemp_node *)calloc(1, sizeof(*node))) == NULL)
+		return (NULL);
+	node->sfd = -1;
+#ifndef HAVE_RENAMEAT2
+	node->norename = 1;
+#endif
+
+	/*
+	 * Numbered nodes are sure to differ; the rest must trust a hash.
+	 * No alphabet is big enough for a number past 32 bits.
+	 */
+	if (id[strspn(id, "0123456789")] == '\0') {
+		for (v = 0, cp = id; *cp != '\0' && v < UINT32_MAX; cp++)
+			v = v * 10 + (*cp - '0');
+		if (v >= UINT32_MAX) {
+			free(node);
+			errno = ERANGE;
+			return (NULL);
+		}
+		node->id = v;
+		node->numbered = 1;
+	} else
+		node->id = node_hash(id);
+	if (dfd == -1)
+		return (node);
+
+#if defined(HAVE_OPENAT) && (defined(HAVE_RENAMEAT2) || defined(HAVE_LINKAT))
+	(void)snprintf(name, sizeof(name), NODE_NAME,
+	    (unsigned long long)node->id, (unsigned long)geteuid());
+	if (mkdirat(dfd, name, S_IRWXU) != 0 && errno != EEXIST)
+		goto bad;
+	node->sfd = openat(dfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW, 0);
+	if (node->sfd == -1)
+		goto bad;
+	/* Whatever we stage must not be visible to anyone else. */
+	if (fstat(node->sfd, &sb) != 0 || sb.st_uid != geteuid() ||
+	    (sb.st_mode & (S_IRWXG|S_IRWXO)) != 0) {
+		errno = EPERM;
+		goto bad;
+	}
+	return (node);
+
+bad:
+	serrno = errno;
+	mktemp_node_close(node);
+	errno = serrno;
+	return (NULL);
+#else
+	(void)name;
+	return (node);
+#endif
+}
+
+void
+mktemp_node_close(node)
+	struct mktemp_node *node;
+{
+	if (node != NULL) {
+		if (node->sfd != -1)
+			(void)close(node->sfd);
+		free(node);
+	}
+}
+
+/*
+ * Move the entry staged as base into place as path, never replacing
+ * anything.  Without renameat2(RENAME_NOREPLACE), which NFS for one
+ * lacks, a file is linked and then unlinked; a directory cannot be,
+ * so the caller gets EOPNOTSUPP.
+ */
+static int
+node_commit(node, base, dfd, path, fd, isdir)
+	struct mktemp_node *node;
+	const char *base;
+	int dfd;
+	const char *path;
+	int fd;
+	int isdir;
+{
+#ifdef HAVE_LINKAT
+	struct stat sb;
+	int serrno;
+#endif
+
+#ifdef HAVE_RENAMEAT2
+	if (!node->norename) {
+		if (renameat2(node->sfd, base, dfd, path,
+		    RENAME_NOREPLACE) == 0)
+			return (0);
+		if (errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+			return (-1);
+		node->norename = 1;
+	}
+#endif
+#ifdef HAVE_LINKAT
+	if (!isdir) {
+		if (linkat(node->sfd, base, dfd, path, 0) != 0) {
+			/* Over NFS, a resent link may fail yet be done. */
+			serrno = errno;
+			if (fstat(fd, &sb) != 0 || sb.st_nlink != 2) {
+				errno = serrno;
+				return (-1);
+			}
+		}
+		(void)unlinkat(node->sfd, base, 0);
+		return (0);
+	}
+#endif
+	errno = EOPNOTSUPP;
+	return (-1);
+}
+
+/*
+ * Create a file or directory for mktemp_internal() by way of the node's
+ * staging directory.  Directories are made in place once we know they
+ * cannot be committed; the node's characters still keep them apart.
+ */
+static int
+node_create(node, dfd, path, mode, flags, perm)
+	struct mktemp_node *node;
+	int dfd;
+	const char *path;
+	int mode;
+	int flags;
+	mode_t perm;
+{
+	const char *base;
+	int fd, serrno;
+
+	if (mode == MKTEMP_DIR && node->norename)
+		return (mkdirat(dfd, path, perm));
+	if ((base = strrchr(path, '/')) != NULL)
+		base++;
+	else
+		base = path;
+	if (mode == MKTEMP_DIR) {
+		if (mkdirat(node->sfd, base, perm) != 0)
+			return (-1);
+		fd = 0;
+	} else {
+		fd = openat(node->sfd, base, O_CREAT|O_EXCL|O_RDWR|flags,
+		    perm);
+		if (fd == -1)
+			return (-1);
+	}
+	if (node_commit(node, base, dfd, path, fd, mode == MKTEMP_DIR) == 0)
+		return (fd);
+
+	serrno = errno;
+	if (mode == MKTEMP_DIR) {
+		(void)unlinkat(node->sfd, base, AT_REMOVEDIR);
+		if (serrno == EOPNOTSUPP)
+			return (mkdirat(dfd, path, perm));
+	} else {
+		(void)close(fd);
+		(void)unlinkat(node->sfd, base, 0);
+	}
+	errno = serrno;
+	return (-1);
+}
+
+/*
+ * Scan the directory a template (relative to dfd) refers to once and
+ * record every entry that could have been generated from it with the
+ * alphabet and node of ctx.  Returns NULL if the directory cannot be
+ * read, in which case callers simply do without.
+ */
+struct mktemp_index *
+mktemp_index_create(dfd, path, slen, ctx)
+	int dfd;
+	const char *path;
+	int slen;
+	const struct mktemp_ctx *ctx;
+{
+	struct mktemp_index *idx;
+	struct alphabet ab;
+	struct dirent *dp;
+	const char *base, *start, *end;
+	char *dir, tag[MKTEMP_NODE_CHARS];
+	size_t len, plen, xlen, vlen, i;
+	DIR *dirp;
+#if defined(HAVE_OPENAT) && defined(HAVE_FDOPENDIR)
+	int fd;
+#endif
+
+	len = strlen(path);
+	if (slen < 0 || (size_t)slen >= len) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	end = path + len - slen;
+	for (start = end; start > path && start[-1] == 'X'; start--)
+		;
+	for (base = start; base > path && base[-1] != '/'; base--)
+		;
+	plen = (size_t)(start - base);
+	xlen = (size_t)(end - start);
+	if (xlen == 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if (get_alphabet(ctx, 0, &ab) != 0)
+		return (NULL);
+	/* Names of our own node end in its characters; only the rest vary. */
+	vlen = xlen;
+	if (ctx != NULL && ctx->node != NULL) {
+		if (xlen <= MKTEMP_NODE_CHARS) {
+			errno = EINVAL;
+			return (NULL);
+		}
+		vlen -= MKTEMP_NODE_CHARS;
+		if (node_tag(ctx->node, &ab, tag) != 0)
+			return (NULL);
+	}
 
-#define TEMPCHARS	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"
-#define NUM_CHARS	(sizeof(TEMPCHARS) - 1)
+	if ((dir = template_dir(path, base)) == NULL)
+		return (NULL);
+#if defined(HAVE_OPENAT) && defined(HAVE_FDOPENDIR)
+	dirp = NULL;
+	if ((fd = openat(dfd, dir, O_RDONLY|O_DIRECTORY, 0)) != -1) {
+		if ((dirp = fdopendir(fd)) == NULL)
+			(void)close(fd);
+	}
+#else
+	dirp = opendir(dir);
+#endif
+	free(dir);
+	if (dirp == NULL)
+		return (NULL);
 
-#ifdef WIN32
-# define mkdir(_path, _mode)	_mkdir(_path)
+	if ((idx = (struct mktemp_index *)calloc(1, sizeof(*idx))) == NULL)
+		goto bad;
+	idx->mask = 63;
+	idx->slots = (uint64_t *)calloc(idx->mask + 1, sizeof(uint64_t));
+	if (idx->slots == NULL)
+		goto bad;
+	idx->xlen = xlen;
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_init(&idx->lock, NULL);
 #endif
+	for (idx->space = 1, i = 0; i < vlen; i++) {
+		if (idx->space > (size_t)-1 / ab.n) {
+			idx->space = (size_t)-1;
+			break;
+		}
+		idx->space *= ab.n;
+	}
 
-#ifndef INT_MAX
-#define INT_MAX	0x7fffffff
+	while ((dp = readdir(dirp)) != NULL) {
+		if (strlen(dp->d_name) != plen + xlen + slen ||
+		    strncmp(dp->d_name, base, plen) != 0 ||
+		    strcmp(dp->d_name + plen + xlen, end) != 0)
+			continue;
+		if (strspn(dp->d_name + plen, ab.chars) < xlen)
+			continue;
+		if (vlen != xlen && memcmp(dp->d_name + plen + vlen, tag,
+		    MKTEMP_NODE_CHARS) != 0)
+			continue;
+		if (index_insert(idx,
+		    index_hash(dp->d_name + plen, xlen)) != 0)
+			goto bad;
+	}
+	(void)closedir(dirp);
+	return (idx);
+bad:
+	(void)closedir(dirp);
+	mktemp_index_free(idx);
+	return (NULL);
+}
+
+void
+mktemp_index_free(idx)
+	struct mktemp_index *idx;
+{
+	if (idx != NULL) {
+#ifdef HAVE_PTHREAD
+		if (idx->slots != NULL)
+			(void)pthread_mutex_destroy(&idx->lock);
 #endif
+		free(idx->slots);
+		free(idx);
+	}
+}
 
 static int
-mktemp_internal(path, mode)
+mktemp_internal(dfd, path, slen, mode, flags, perm, ctx, fd, from)
+	int dfd;		/* directory relative paths start at */
 	char *path;
+	int slen;		/* characters after the Xs */
 	int mode;
+	int flags;		/* extra open flags for MKTEMP_FILE */
+	mode_t perm;
+	struct mktemp_ctx *ctx;
+	int fd;			/* file to name, for MKTEMP_LINK */
+	const char *from;	/* entry relative to fd, for MKTEMP_RENAME */
 {
-	char *start, *cp;
-	const char *tempchars = TEMPCHARS;
-	unsigned int r, tries;
-	int fd;
+	struct mktemp_index *idx = NULL;
+	struct mktemp_timing *tm = NULL;
+	struct mktemp_node *node = NULL;
+	struct alphabet ab;
+	struct stat sb;
+	unsigned long long t0 = 0;
+	char *start, *end, *rend, *cp, *fan = NULL, *leaf = path;
+	size_t len;
+	unsigned int tries, walk = 0;
+	int rval, taken, staged, levels = 0, ldfd = dfd, bfd = dfd, shared = 0;
+	int efd, serrno;
 
-	if (*path == '\0') {
+	len = strlen(path);
+	if (len == 0 || slen < 0 || (size_t)slen >= len) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if ((flags & ~MKOTEMP_FLAGS) != 0) {
 		errno = EINVAL;
 		return (-1);
 	}
 
-	for (start = path; *start; start++)
-		;
+	if (ctx != NULL && ctx->fanout != 0)
+		levels = ctx->fanout;
+	if (get_alphabet(ctx, levels, &ab) != 0)
+		return (-1);
+
+	end = path + len - slen;
+	for (start = end; start > path && start[-1] == 'X'; start--)
+		continue;
+
+	/* A node's own characters end the suffix, only the rest vary. */
+	rend = end;
+	if (ctx != NULL && ctx->node != NULL) {
+		node = ctx->node;
+		if (end - start <= MKTEMP_NODE_CHARS) {
+			errno = EINVAL;
+			return (-1);
+		}
+		rend = end - MKTEMP_NODE_CHARS;
+		if (node_tag(node, &ab, rend) != 0)
+			return (-1);
+	}
+	staged = node != NULL && node->sfd != -1;
+
 	tries = 1;
-	for (; start > path && start[-1] == 'X'; start--) {
-		if (tries < INT_MAX / NUM_CHARS)
-			tries *= NUM_CHARS;
+	for (cp = start; cp < rend; cp++) {
+		if (tries < INT_MAX / ab.n)
+			tries *= ab.n;
 	}
 	tries *= 2;
 
+	if (levels != 0) {
+		if (levels < 0 || rend - start < 2 * levels ||
+		    (fan = fanout_dirs(path, start, levels)) == NULL) {
+			errno = EINVAL;
+			return (-1);
+		}
+		/* The fan-out goes in bfd, opened once for all the tries. */
+		if (fan != path) {
+			fan[-1] = '\0';
+			bfd = openat(dfd, fan - 1 == path ? "/" : path,
+			    O_RDONLY|O_DIRECTORY|O_CLOEXEC, 0);
+			fan[-1] = '/';
+			if (bfd == -1)
+				return (-1);
+		}
+		shared = fstat(bfd, &sb) == 0 &&
+		    (sb.st_mode & (S_ISVTX|S_IWOTH)) == (S_ISVTX|S_IWOTH);
+	}
+
+	if (ctx != NULL && ctx->index != NULL &&
+	    ctx->index->xlen == (size_t)(end - start))
+		idx = ctx->index;
+	if (ctx != NULL)
+		tm = ctx->timing;
+
+	/*
+	 * Chance alone takes long to hit the last few free names of a small
+	 * name space.  With an index to skip the taken ones, the random
+	 * tries end with a pass over every name in turn.
+	 */
+	if (idx != NULL && tries / 2 < INT_MAX / ab.n) {
+		walk = tries / 2;
+		tries += walk;
+	}
+
 	do {
-		for (cp = start; *cp; cp++) {
-			r = arc4random_uniform(NUM_CHARS);
-			*cp = tempchars[r];
+		if (tries <= walk)
+			step_suffix(&ab, start, (size_t)(rend - start));
+		else
+			next_suffix(ctx, &ab, start, (size_t)(rend - start));
+		fill_fanout(fan, start, levels);
+		if (idx != NULL) {
+			INDEX_LOCK(idx);
+			if (idx->count >= idx->space) {
+				/* Every name there could be is taken. */
+				INDEX_UNLOCK(idx);
+				break;
+			}
+			taken = index_lookup(idx, start,
+			    (size_t)(end - start));
+			INDEX_UNLOCK(idx);
+			if (taken) {
+				ctx->skipped++;
+				continue;
+			}
+		}
+		if (ctx != NULL)
+			ctx->attempts++;
+
+		/* The entry is made relative to its own fan-out directory. */
+		if (fan != NULL) {
+			if (ldfd != dfd)
+				(void)close(ldfd);
+			ldfd = open_fanout(bfd, fan, levels, shared);
+			if (ldfd == -1) {
+				ldfd = dfd;
+				rval = -1;
+				if (errno != EPERM && errno != ELOOP &&
+				    errno != ENOTDIR && errno != ENOENT)
+					goto done;
+				/*
+				 * Not ours to use, or reaped as we went:
+				 * as good as taken.
+				 */
+				if (ctx != NULL)
+					ctx->collisions++;
+				continue;
+			}
+			leaf = fan + 3 * levels;
 		}
 
+		if (tm != NULL)
+			t0 = timing_now();
 		switch (mode) {
 		case MKTEMP_FILE:
-			fd = open(path, O_CREAT|O_EXCL|O_RDWR, S_IRUSR|S_IWUSR);
-			if (fd != -1 || errno != EEXIST)
-				return (fd);
+			if (staged)
+				rval = node_create(node, ldfd, leaf, mode,
+				    flags & ~O_DIRECT, perm);
+			else
+				rval = openat(ldfd, leaf,
+				    O_CREAT|O_EXCL|O_RDWR|(flags & ~O_DIRECT),
+				    perm);
 			break;
 		case MKTEMP_DIR:
-			if (mkdir(path, S_IRUSR|S_IWUSR|S_IXUSR) == 0)
-				return (0);
-			if (errno != EEXIST)
-				return (-1);
+			if (staged)
+				rval = node_create(node, ldfd, leaf, mode, 0,
+				    perm);
+			else
+				rval = mkdirat(ldfd, leaf, perm);
+			break;
+		case MKTEMP_LINK:
+			rval = link_anon(fd, ldfd, leaf);
+			break;
+#ifdef HAVE_RENAMEAT2
+		case MKTEMP_RENAME:
+			rval = renameat2(fd, from, ldfd, leaf,
+			    RENAME_NOREPLACE);
+			break;
+#endif
+		default:
+			rval = -1;
+			errno = EINVAL;
 			break;
 		}
+		if (tm != NULL)
+			timing_add(tm, t0);
+		/* An emptied fan-out directory may be reaped under us. */
+		if (rval != -1 || (errno != EEXIST && (errno != ENOENT ||
+		    fan == NULL || staged || (mode != MKTEMP_FILE &&
+		    mode != MKTEMP_DIR))))
+			goto done;
+		if (ctx != NULL)
+			ctx->collisions++;
+		if (idx != NULL) {
+			/* Someone else got there first; remember it. */
+			INDEX_LOCK(idx);
+			(void)index_insert(idx,
+			    index_hash(start, (size_t)(end - start)));
+			INDEX_UNLOCK(idx);
+		}
 	} while (--tries);
 
+	rval = -1;
 	errno = EEXIST;
-	return (-1);
+
+done:
+	if (rval != -1 && idx != NULL) {
+		INDEX_LOCK(idx);
+		(void)index_insert(idx,
+		    index_hash(start, (size_t)(end - start)));
+		INDEX_UNLOCK(idx);
+	}
+	/* A renamed entry is given perm, if any, once it is ours. */
+	if (rval != -1 && mode == MKTEMP_RENAME && perm != 0) {
+		efd = openat(ldfd, leaf, O_RDONLY|O_NOFOLLOW|O_CLOEXEC, 0);
+		if (efd == -1 || fchmod(efd, perm) != 0) {
+			serrno = errno;
+			if (unlinkat(ldfd, leaf, 0) != 0)
+				(void)unlinkat(ldfd, leaf, AT_REMOVEDIR);
+			errno = serrno;
+			rval = -1;
+		}
+		if (efd != -1)
+			(void)close(efd);
+	}
+	if (rval != -1 && (mode == MKTEMP_FILE || mode == MKTEMP_DIR))
+		rval = provision_entry(ldfd, leaf, mode, flags, ctx, rval);
+	serrno = errno;
+	if (ldfd != dfd)
+		(void)close(ldfd);
+	if (bfd != dfd)
+		(void)close(bfd);
+	errno = serrno;
+	return (rval);
 }
 
 int
 priv_mkstemp(path)
 	char *path;
 {
-	return (mktemp_internal(path, MKTEMP_FILE));
+	return (mktemp_internal(AT_FDCWD, path, 0, MKTEMP_FILE, 0,
+	    S_IRUSR|S_IWUSR, NULL, -1, NULL));
 }
 
 char *
@@ -109,6 +1535,785 @@ priv_mkdtemp(path)
 {
 	int error;
 
-	error = mktemp_internal(path, MKTEMP_DIR);
+	error = mktemp_internal(AT_FDCWD, path, 0, MKTEMP_DIR, 0,
+	    S_IRUSR|S_IWUSR|S_IXUSR, NULL, -1, NULL);
+	return (error ? NULL : path);
+}
+
+/*
+ * A directory with a skeleton is built under a staging name in the
+ * directory it goes in (above any fan-out) and then renamed into
+ * place.  The staging directory is held open meanwhile, so building
+ * the skeleton looks up nothing but its own entries.
+ */
+#define SKEL_STAGE	".mktemp-skel.XXXXXXXXXX"
+
+static int
+skel_mkdtemp(dfd, path, slen, perm, ctx)
+	int dfd;
+	char *path;
+	int slen;
+	mode_t perm;
+	struct mktemp_ctx *ctx;
+{
+	struct mktemp_ctx sctx;
+	unsigned long long t0 = 0;
+	char stage[PATH_MAX], *cp;
+	size_t dlen;
+	int sfd = -1, n, rval, serrno;
+
+	cp = strrchr(path, '/');
+	dlen = cp ? (size_t)(cp + 1 - path) : 0;
+	if (dlen < 3 * (size_t)ctx->fanout) {
+		errno = EINVAL;
+		return (-1);
+	}
+	dlen -= 3 * ctx->fanout;
+	if (dlen + sizeof(SKEL_STAGE) > sizeof(stage)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	(void)memcpy(stage, path, dlen);
+	(void)memcpy(stage + dlen, SKEL_STAGE, sizeof(SKEL_STAGE));
+
+	/* The staging name is ours alone, whatever the caller's options. */
+	(void)memset(&sctx, 0, sizeof(sctx));
+	sctx.provision = ctx->provision;
+	sctx.timing = ctx->timing;
+	if (mktemp_internal(dfd, stage, 0, MKTEMP_DIR, 0, perm, &sctx, -1,
+	    NULL) == -1)
+		return (-1);
+	ctx->rngbytes += sctx.rngbytes;
+	sfd = openat(dfd, stage, O_RDONLY|O_DIRECTORY|O_NOFOLLOW, 0);
+	if (sfd == -1)
+		goto bad;
+
+	if (ctx->timing != NULL)
+		t0 = timing_now();
+	n = mktemp_skel_build(sfd, ctx->skel);
+	if (ctx->timing != NULL)
+		ctx->timing->skel_nsecs += timing_now() - t0;
+	if (n == -1)
+		goto bad;
+	ctx->skelents += n;
+
+	rval = mktemp_internal(dfd, path, slen, MKTEMP_RENAME, 0, 0, ctx, dfd,
+	    stage);
+	if (rval == -1 &&
+	    (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+		/* Hold the name with an empty directory, then replace it. */
+		rval = mktemp_internal(dfd, path, slen, MKTEMP_DIR, 0, perm,
+		    ctx, -1, NULL);
+		if (rval != -1) {
+#ifdef HAVE_OPENAT
+			rval = renameat(dfd, stage, dfd, path);
+#else
+			rval = rename(stage, path);
+#endif
+			if (rval == -1) {
+				serrno = errno;
+				(void)unlinkat(dfd, path, AT_REMOVEDIR);
+				errno = serrno;
+			}
+		}
+	}
+	if (rval == -1)
+		goto bad;
+	(void)close(sfd);
+	return (0);
+
+bad:
+	serrno = errno;
+	if (sfd != -1) {
+		skel_remove(sfd, ctx->skel);
+		(void)close(sfd);
+	}
+	(void)unlinkat(dfd, stage, AT_REMOVEDIR);
+	errno = serrno;
+	return (-1);
+}
+
+int
+mktemp_mkostempsat(dfd, path, slen, flags, perm, ctx)
+	int dfd;
+	char *path;
+	int slen;
+	int flags;
+	mode_t perm;
+	struct mktemp_ctx *ctx;
+{
+	return (mktemp_internal(dfd, path, slen, MKTEMP_FILE, flags, perm,
+	    ctx, -1, NULL));
+}
+
+int
+mktemp_mkostemps(path, slen, flags, perm)
+	char *path;
+	int slen;
+	int flags;
+	mode_t perm;
+{
+	return (mktemp_internal(AT_FDCWD, path, slen, MKTEMP_FILE, flags,
+	    perm, NULL, -1, NULL));
+}
+
+char *
+mktemp_mkdtempsat(dfd, path, slen, perm, ctx)
+	int dfd;
+	char *path;
+	int slen;
+	mode_t perm;
+	struct mktemp_ctx *ctx;
+{
+	int error;
+
+	if (ctx != NULL && ctx->skel != NULL)
+		error = skel_mkdtemp(dfd, path, slen, perm, ctx);
+	else
+		error = mktemp_internal(dfd, path, slen, MKTEMP_DIR, 0, perm,
+		    ctx, -1, NULL);
 	return (error ? NULL : path);
 }
+
+#ifdef HAVE_IO_URING
+/*
+ * An entry of a batch being created through io_uring.
+ */
+struct batch_slot {
+	char *start;		/* the Xs, NULL if the template is bad */
+	char *end;
+	unsigned int tries;	/* names left to try */
+	int res;		/* descriptor (0 for a directory) or -errno */
+};
+
+/*
+ * Pick the next name for a slot, skipping those the index knows are
+ * taken.  Returns -1 once there are none left to try.
+ */
+static int
+batch_name(s, ab, idx, ctx)
+	struct batch_slot *s;
+	const struct alphabet *ab;
+	struct mktemp_index *idx;
+	struct mktemp_ctx *ctx;
+{
+	size_t xlen = (size_t)(s->end - s->start);
+	int taken;
+
+	while (s->tries != 0) {
+		s->tries--;
+		next_suffix(ctx, ab, s->start, xlen);
+		if (idx == NULL)
+			return (0);
+		INDEX_LOCK(idx);
+		if (idx->count >= idx->space) {
+			INDEX_UNLOCK(idx);
+			break;
+		}
+		taken = index_lookup(idx, s->start, xlen);
+		INDEX_UNLOCK(idx);
+		if (!taken)
+			return (0);
+		ctx->skipped++;
+	}
+	return (-1);
+}
+
+static void
+batch_prep(ring, k, dfd, path, flags, perm, isdir, ctx)
+	struct uring *ring;
+	int k;
+	int dfd;
+	char *path;
+	int flags;
+	mode_t perm;
+	int isdir;
+	struct mktemp_ctx *ctx;
+{
+	struct io_uring_sqe *sqe;
+
+	/* The ring has room for every slot and its close. */
+	sqe = uring_sqe(ring);
+	sqe->opcode = isdir ? IORING_OP_MKDIRAT : IORING_OP_OPENAT;
+	sqe->fd = dfd;
+	sqe->addr = (unsigned long)path;
+	sqe->len = perm;
+	if (!isdir)
+		sqe->open_flags = O_CREAT|O_EXCL|O_RDWR|(flags & ~O_DIRECT);
+	sqe->user_data = (unsigned long long)k;
+	if (ctx != NULL)
+		ctx->attempts++;
+}
+
+/*
+ * Create up to BATCH_MAX entries with as few system calls as we can:
+ * submit them all, then resubmit only those that collided under new
+ * names.  Entries that run into anything else are left, Xs and all,
+ * for the caller to retry the ordinary way, which also gives a proper
+ * error if need be.  Returns the number created, which are moved to
+ * the front of paths.
+ */
+static int
+batch_window(ring, dfd, paths, n, slen, flags, perm, isdir, fds, ctx)
+	struct uring *ring;
+	int dfd;
+	char **paths;
+	int n;
+	int slen;
+	int flags;
+	mode_t perm;
+	int isdir;
+	int *fds;
+	struct mktemp_ctx *ctx;
+{
+	struct batch_slot slots[BATCH_MAX], *s;
+	struct io_uring_sqe *sqe;
+	struct mktemp_index *idx;
+	struct mktemp_timing *tm;
+	struct alphabet ab;
+	unsigned long long data, t0 = 0;
+	size_t len;
+	char *tmp;
+	int k, j, res, inflight = 0;
+
+	idx = ctx != NULL ? ctx->index : NULL;
+	tm = ctx != NULL ? ctx->timing : NULL;
+	/* The caller's own attempt at the first entry will say why. */
+	if (get_alphabet(ctx, 0, &ab) != 0)
+		return (0);
+	if (n > BATCH_MAX)
+		n = BATCH_MAX;
+	for (k = 0; k < n; k++) {
+		s = &slots[k];
+		s->start = NULL;
+		s->res = -EINVAL;
+		len = strlen(paths[k]);
+		if (len == 0 || slen < 0 || (size_t)slen >= len)
+			continue;
+		s->end = paths[k] + len - slen;
+		s->tries = 1;
+		for (s->start = s->end; s->start > paths[k] &&
+		    s->start[-1] == 'X'; s->start--) {
+			if (s->tries < INT_MAX / ab.n)
+				s->tries *= ab.n;
+		}
+		s->tries *= 2;
+		if (idx != NULL && idx->xlen != (size_t)(s->end - s->start))
+			idx = NULL;
+		s->res = -EEXIST;
+		if (batch_name(s, &ab, idx, ctx) != 0)
+			continue;
+		batch_prep(ring, k, dfd, paths[k], flags, perm, isdir, ctx);
+		inflight++;
+	}
+
+	while (inflight != 0) {
+		if (tm != NULL)
+			t0 = timing_now();
+		res = uring_submit(ring, 1);
+		if (tm != NULL)
+			timing_add(tm, t0);
+		if (res != 0)
+			break;
+		while (uring_result(ring, &data, &res)) {
+			inflight--;
+			if (data == BATCH_CLOSE)
+				continue;
+			k = (int)data;
+			s = &slots[k];
+			if (res >= 0) {
+				if (idx != NULL) {
+					INDEX_LOCK(idx);
+					(void)index_insert(idx,
+					    index_hash(s->start,
+					    (size_t)(s->end - s->start)));
+					INDEX_UNLOCK(idx);
+				}
+				s->res = provision_entry(dfd, paths[k],
+				    isdir ? MKTEMP_DIR : MKTEMP_FILE, flags,
+				    ctx, res);
+				if (s->res == -1)
+					s->res = -errno;
+				else if (!isdir && fds == NULL) {
+					sqe = uring_sqe(ring);
+					sqe->opcode = IORING_OP_CLOSE;
+					sqe->fd = res;
+					sqe->user_data = BATCH_CLOSE;
+					inflight++;
+				}
+			} else if (res == -EEXIST) {
+				if (ctx != NULL)
+					ctx->collisions++;
+				if (idx != NULL) {
+					INDEX_LOCK(idx);
+					(void)index_insert(idx,
+					    index_hash(s->start,
+					    (size_t)(s->end - s->start)));
+					INDEX_UNLOCK(idx);
+				}
+				if (batch_name(s, &ab, idx, ctx) == 0) {
+					batch_prep(ring, k, dfd, paths[k],
+					    flags, perm, isdir, ctx);
+					inflight++;
+				}
+			} else
+				s->res = res;
+		}
+	}
+
+	if (inflight != 0) {
+		/*
+		 * uring_submit() failed.  Take back what the kernel never
+		 * took and see the rest through, so that nothing is left
+		 * pointing into paths: entries made meanwhile are removed
+		 * again, for the caller to retry the ordinary way.
+		 */
+		while ((sqe = uring_unsubmit(ring)) != NULL) {
+			inflight--;
+			if (sqe->user_data == BATCH_CLOSE)
+				(void)close(sqe->fd);
+		}
+		while (inflight != 0 && uring_submit(ring, 1) == 0) {
+			while (uring_result(ring, &data, &res)) {
+				inflight--;
+				if (data == BATCH_CLOSE || res < 0)
+					continue;
+				if (!isdir)
+					(void)close(res);
+				(void)unlinkat(dfd, paths[data],
+				    isdir ? AT_REMOVEDIR : 0);
+			}
+		}
+	}
+
+	for (k = 0, j = 0; k < n; k++) {
+		s = &slots[k];
+		if (s->res < 0) {
+			if (s->start != NULL)
+				(void)memset(s->start, 'X',
+				    (size_t)(s->end - s->start));
+			continue;
+		}
+		if (fds != NULL)
+			fds[j] = isdir ? -1 : s->res;
+		tmp = paths[j];
+		paths[j] = paths[k];
+		paths[k] = tmp;
+		j++;
+	}
+	return (j);
+}
+#endif /* HAVE_IO_URING */
+
+int
+mktemp_batchat(dfd, paths, n, slen, flags, perm, isdir, fds, ctx)
+	int dfd;
+	char **paths;
+	int n;
+	int slen;
+	int flags;
+	mode_t perm;
+	int isdir;
+	int *fds;
+	struct mktemp_ctx *ctx;
+{
+#ifdef HAVE_IO_URING
+	struct uring ring;
+	int want, got, serrno, use_ring = 0;
+#endif
+	int done = 0, rval;
+
+	if (n < 0 || (flags & ~MKOTEMP_FLAGS) != 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+#ifdef HAVE_IO_URING
+	/*
+	 * Staged entries need a commit each, and fan-out directories must
+	 * be checked before anything goes in them, so both are taken one
+	 * at a time.
+	 */
+	if (n > 1 && (ctx == NULL || (ctx->node == NULL &&
+	    ctx->fanout == 0 && (ctx->skel == NULL || !isdir))) &&
+	    uring_open(&ring, 2 * BATCH_MAX) == 0)
+		use_ring = 1;
+#endif
+	while (done < n) {
+#ifdef HAVE_IO_URING
+		if (use_ring) {
+			want = n - done < BATCH_MAX ? n - done : BATCH_MAX;
+			got = batch_window(&ring, dfd, paths + done, want,
+			    slen, flags, perm, isdir, fds ? fds + done : NULL,
+			    ctx);
+			done += got;
+			if (got == want)
+				continue;
+			/* If io_uring got nowhere, don't use it again. */
+			if (got == 0) {
+				uring_close(&ring);
+				use_ring = 0;
+			}
+		}
+#endif
+		/* One at a time, which deals with (or reports) any snag. */
+		if (isdir && ctx != NULL && ctx->skel != NULL)
+			rval = skel_mkdtemp(dfd, paths[done], slen, perm, ctx);
+		else
+			rval = mktemp_internal(dfd, paths[done], slen,
+			    isdir ? MKTEMP_DIR : MKTEMP_FILE,
+			    isdir ? 0 : flags, perm, ctx, -1, NULL);
+		if (rval == -1)
+			break;
+		if (fds != NULL)
+			fds[done] = isdir ? -1 : rval;
+		else if (!isdir)
+			(void)close(rval);
+		done++;
+	}
+#ifdef HAVE_IO_URING
+	if (use_ring) {
+		serrno = errno;
+		uring_close(&ring);
+		errno = serrno;
+	}
+#endif
+	return (done);
+}
+
+/*
+ * The directory is found by temporarily terminating path at its last
+ * slash, so no copy is needed.
+ */
+int
+mktemp_anonat(dfd, path, flags, perm)
+	int dfd;
+	char *path;
+	int flags;
+	mode_t perm;
+{
+#if defined(HAVE_LINKAT) && defined(O_TMPFILE)
+	char *base;
+	int fd, serrno;
+
+	if ((flags & ~MKOTEMP_FLAGS) != 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if ((base = strrchr(path, '/')) == NULL)
+		return (openat(dfd, ".", O_TMPFILE|O_RDWR|flags, perm));
+	if (base == path)
+		return (openat(dfd, "/", O_TMPFILE|O_RDWR|flags, perm));
+	*base = '\0';
+	fd = openat(dfd, path, O_TMPFILE|O_RDWR|flags, perm);
+	serrno = errno;
+	*base = '/';
+	errno = serrno;
+	return (fd);
+#else
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
+
+int
+mktemp_linkat(fd, dfd, path, slen, ctx)
+	int fd;
+	int dfd;
+	char *path;
+	int slen;
+	struct mktemp_ctx *ctx;
+{
+	return (mktemp_internal(dfd, path, slen, MKTEMP_LINK, 0, 0, ctx, fd,
+	    NULL));
+}
+
+/*
+ * Just the name, with nothing behind it: the suffix, any node's own
+ * characters and the fan-out directories are filled in as usual.
+ */
+int
+mktemp_mktemps(path, slen, ctx)
+	char *path;
+	int slen;
+	struct mktemp_ctx *ctx;
+{
+	struct alphabet ab;
+	char *start, *end, *fan = NULL;
+	size_t len;
+	int levels;
+
+	len = strlen(path);
+	if (len == 0 || slen < 0 || (size_t)slen >= len) {
+		errno = EINVAL;
+		return (-1);
+	}
+	levels = ctx != NULL ? ctx->fanout : 0;
+	if (get_alphabet(ctx, levels, &ab) != 0)
+		return (-1);
+	end = path + len - slen;
+	for (start = end; start > path && start[-1] == 'X'; start--)
+		continue;
+	if (ctx != NULL && ctx->node != NULL) {
+		if (end - start <= MKTEMP_NODE_CHARS)
+			goto bad;
+		end -= MKTEMP_NODE_CHARS;
+		if (node_tag(ctx->node, &ab, end) != 0)
+			return (-1);
+	}
+	if (levels != 0 && (levels < 0 || end - start < 2 * levels ||
+	    (fan = fanout_dirs(path, start, levels)) == NULL))
+		goto bad;
+	next_suffix(ctx, &ab, start, (size_t)(end - start));
+	fill_fanout(fan, start, levels);
+	return (0);
+
+bad:
+	errno = EINVAL;
+	return (-1);
+}
+
+/*
+ * The name is only a label, shown in /proc, so there is nothing to
+ * collide with and a single try is enough.  Linux limits it to 249
+ * bytes; longer ones are cut short rather than refused.
+ */
+#define MEMFD_NAME_MAX	249
+
+int
+mktemp_memfd(path, slen, seals, ctx)
+	char *path;
+	int slen;
+	int seals;
+	struct mktemp_ctx *ctx;
+{
+#ifdef HAVE_MEMFD_CREATE
+	struct mktemp_timing *tm = NULL;
+	unsigned long long t0 = 0;
+	char *base, name[MEMFD_NAME_MAX + 1];
+	int fd, serrno;
+
+	if (mktemp_mktemps(path, slen, ctx) != 0)
+		return (-1);
+	base = strrchr(path, '/');
+	(void)snprintf(name, sizeof(name), "%s", base ? base + 1 : path);
+
+	if (ctx != NULL) {
+		ctx->attempts++;
+		tm = ctx->timing;
+	}
+	if (tm != NULL)
+		t0 = timing_now();
+	fd = memfd_create(name, MFD_CLOEXEC | (seals ? MFD_ALLOW_SEALING : 0));
+	if (tm != NULL)
+		timing_add(tm, t0);
+	if (fd == -1)
+		return (-1);
+	if (mktemp_provision(fd, ctx) != 0 ||
+	    (seals != 0 && fcntl(fd, F_ADD_SEALS, seals) != 0)) {
+		serrno = errno;
+		(void)close(fd);
+		errno = serrno;
+		return (-1);
+	}
+	return (fd);
+#else
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
+
+/*
+ * A reservoir is a private staging directory inside the target
+ * directory that is kept stocked with pre-created files ("f.*") and
+ * directories ("d.*").  Claiming one is a single rename to a random
+ * name, which does not depend on how long it takes to create an
+ * inode when the directory is busy.  The rename must not replace
+ * anything, so reservoirs need renameat2(RENAME_NOREPLACE).
+ */
+#define RESERVOIR_NAME	".mktemp-reservoir.%lu"
+#define RESERVOIR_SCAN	64	/* candidates considered per claim */
+#define RESERVOIR_NLEN	16	/* longest staged name, with NUL */
+
+int
+mktemp_reservoir_open(dfd)
+	int dfd;
+{
+#if defined(HAVE_RENAMEAT2) && defined(HAVE_FDOPENDIR)
+	char name[sizeof(RESERVOIR_NAME) + 20];
+	struct stat sb;
+	int rfd;
+
+	(void)snprintf(name, sizeof(name), RESERVOIR_NAME,
+	    (unsigned long)geteuid());
+	if (mkdirat(dfd, name, S_IRWXU) != 0 && errno != EEXIST)
+		return (-1);
+	rfd = openat(dfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW, 0);
+	if (rfd == -1)
+		return (-1);
+	/* Someone else's directory could be stocked with anything. */
+	if (fstat(rfd, &sb) != 0 || sb.st_uid != geteuid() ||
+	    (sb.st_mode & (S_IRWXG|S_IRWXO)) != 0) {
+		(void)close(rfd);
+		errno = EPERM;
+		return (-1);
+	}
+	return (rfd);
+#else
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
+
+#if defined(HAVE_RENAMEAT2) && defined(HAVE_FDOPENDIR)
+/*
+ * Count the staged entries of one kind.  If names is not NULL, stop
+ * after recording the names of nnames of them.
+ */
+static long
+reservoir_scan(rfd, isdir, names, nnames)
+	int rfd;
+	int isdir;
+	char (*names)[RESERVOIR_NLEN];
+	int nnames;
+{
+	struct dirent *dp;
+	DIR *dirp;
+	long n = 0;
+	int fd;
+
+	if ((fd = openat(rfd, ".", O_RDONLY|O_DIRECTORY, 0)) == -1)
+		return (-1);
+	if ((dirp = fdopendir(fd)) == NULL) {
+		(void)close(fd);
+		return (-1);
+	}
+	while ((dp = readdir(dirp)) != NULL) {
+		if (dp->d_name[0] != (isdir ? 'd' : 'f') ||
+		    dp->d_name[1] != '.' ||
+		    strlen(dp->d_name) >= RESERVOIR_NLEN)
+			continue;
+		if (names != NULL)
+			(void)strcpy(names[n], dp->d_name); /* SAFE */
+		if (++n == nnames && names != NULL)
+			break;
+	}
+	(void)closedir(dirp);
+	return (n);
+}
+#endif
+
+long
+mktemp_reservoir_level(rfd, isdir)
+	int rfd;
+	int isdir;
+{
+#if defined(HAVE_RENAMEAT2) && defined(HAVE_FDOPENDIR)
+	return (reservoir_scan(rfd, isdir, NULL, 0));
+#else
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
+
+int
+mktemp_reservoir_claim(rfd, dfd, path, slen, isdir, mode, ctx)
+	int rfd;
+	int dfd;
+	char *path;
+	int slen;
+	int isdir;
+	mode_t mode;
+	struct mktemp_ctx *ctx;
+{
+#if defined(HAVE_RENAMEAT2) && defined(HAVE_FDOPENDIR)
+	char names[RESERVOIR_SCAN][RESERVOIR_NLEN];
+	char *start, *end;
+	size_t len;
+	long n, i, first;
+
+	len = strlen(path);
+	if (slen < 0 || (size_t)slen >= len) {
+		errno = EINVAL;
+		return (-1);
+	}
+	end = path + len - slen;
+	for (start = end; start > path && start[-1] == 'X'; start--)
+		;
+
+	n = reservoir_scan(rfd, isdir, names, RESERVOIR_SCAN);
+	/* Start somewhere random so concurrent claims rarely race. */
+	first = n > 1 ? (long)arc4random_uniform((unsigned int)n) : 0;
+	for (i = 0; i < n; i++) {
+		if (mktemp_internal(dfd, path, slen, MKTEMP_RENAME, 0, mode,
+		    ctx, rfd, names[(first + i) % n]) == 0) {
+			if (ctx != NULL)
+				ctx->hits++;
+			return (0);
+		}
+		(void)memset(start, 'X', (size_t)(end - start));
+		if (errno != ENOENT)
+			break;
+		/* Somebody else claimed it first. */
+	}
+	if (ctx != NULL)
+		ctx->misses++;
+	if (i == n)
+		errno = ENOENT;
+	return (-1);
+#else
+	if (ctx != NULL)
+		ctx->misses++;
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
+
+/*
+ * Top the reservoir up to high entries if it has dropped below low.
+ * Only one process fills a reservoir at a time; if another already
+ * is, we leave it to them.  Returns the number of entries created.
+ */
+long
+mktemp_reservoir_fill(rfd, isdir, low, high)
+	int rfd;
+	int isdir;
+	unsigned long low;
+	unsigned long high;
+{
+#if defined(HAVE_RENAMEAT2) && defined(HAVE_FDOPENDIR)
+	char name[RESERVOIR_NLEN];
+	long level, n = 0;
+	int fd;
+
+# ifdef HAVE_FLOCK
+	if (flock(rfd, LOCK_EX|LOCK_NB) != 0)
+		return (errno == EWOULDBLOCK ? 0 : -1);
+# endif
+	if ((level = reservoir_scan(rfd, isdir, NULL, 0)) == -1)
+		n = -1;
+	else if ((unsigned long)level < low) {
+		for (; (unsigned long)level < high; level++) {
+			(void)strcpy(name,
+			    isdir ? "d.XXXXXXXXXX" : "f.XXXXXXXXXX");
+			fd = mktemp_internal(rfd, name, 0,
+			    isdir ? MKTEMP_DIR : MKTEMP_FILE, 0,
+			    isdir ? S_IRWXU : S_IRUSR|S_IWUSR, NULL, -1, NULL);
+			if (fd == -1) {
+				if (n == 0)
+					n = -1;
+				break;
+			}
+			if (!isdir)
+				(void)close(fd);
+			n++;
+		}
+	}
+# ifdef HAVE_FLOCK
+	(void)flock(rfd, LOCK_UN);
+# endif
+	return (n);
+#else
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
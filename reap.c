@@ -0,0 +1,576 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Removal of stale temporary entries (mktemp -r).
+ *
+ * Directories still to be read are kept on a shared stack that any
+ * number of threads take work from, so a single huge tree is removed
+ * in parallel just like many small ones.  Each directory counts the
+ * subdirectories it is waiting for; whoever removes the last one
+ * removes the directory itself.  Everything is done with unlinkat()
+ * and openat(O_NOFOLLOW) relative to the parent, so nothing outside
+ * the tree can be reached through a symbolic link, and other file
+ * systems mounted inside it are left alone.  Only so many directories
+ * are held open; the others are opened again by name when needed, and
+ * must then still be the same directory.
+ *
+ * An entry is leased, and left alone, while someone holds a flock(2)
+ * lock on it, e.g. with flock(1) for as long as a job runs.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+#ifdef HAVE_FLOCK
+# include <sys/file.h>
+#endif
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif /* HAVE_STRINGS_H */
+#endif /* HAVE_STRING_H */
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include <extern.h>
+
+#if defined(HAVE_OPENAT) && defined(HAVE_FDOPENDIR) && \
+    defined(HAVE_UNLINKAT) && defined(HAVE_FSTATAT)
+
+#ifndef O_DIRECTORY
+# define O_DIRECTORY	0
+#endif
+#ifndef O_NOFOLLOW
+# define O_NOFOLLOW	0
+#endif
+#ifndef O_CLOEXEC
+# define O_CLOEXEC	0
+#endif
+
+#define REAP_TREE	-1	/* depth of directories inside an entry */
+#define REAP_FDS	64	/* directories held open when not in use */
+
+/*
+ * A directory that has been found but not yet removed.
+ */
+struct rdir {
+	struct rdir *parent;	/* NULL for the directory being reaped */
+	struct rdir *next;	/* on the work stack */
+	int fd;			/* open while being read, -1 if closed */
+	int users;		/* threads using fd */
+	ino_t ino;		/* the directory, once opened */
+	int depth;		/* fan-out levels still below, or REAP_TREE */
+	unsigned long pending;	/* its own scan and unremoved subdirs */
+	char name[1];		/* relative to the parent */
+};
+
+struct reaper {
+	const char *tmpl;	/* last component of the template */
+	size_t tlen;		/* its length */
+	size_t xoff;		/* where its Xs start */
+	const char *chars;	/* what the Xs may be, NULL if alphanumeric */
+	time_t cutoff;		/* only entries modified no later than this */
+	uid_t uid;		/* only entries owned by this user, unless 0 */
+	dev_t dev;		/* the file system we stay on */
+	long maxfds;		/* directories we may hold open */
+	long nopen;		/* directories we do hold open */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+	struct rdir *work;	/* directories waiting to be read */
+	unsigned long busy;	/* workers reading one */
+	struct reap_stats stats;
+};
+
+#ifdef HAVE_PTHREAD
+# define REAP_LOCK(r)	pthread_mutex_lock(&(r)->lock)
+# define REAP_UNLOCK(r)	pthread_mutex_unlock(&(r)->lock)
+#else
+# define REAP_LOCK(r)
+# define REAP_UNLOCK(r)
+#endif
+
+/*
+ * Could name have been made from the template?
+ */
+static int
+reap_match(r, name)
+	struct reaper *r;
+	const char *name;
+{
+	size_t i;
+
+	if (strlen(name) != r->tlen || memcmp(name, r->tmpl, r->xoff) != 0)
+		return (0);
+	for (i = r->xoff; i < r->tlen; i++) {
+		if (r->chars != NULL ? strchr(r->chars, name[i]) == NULL :
+		    !isalnum((unsigned char)name[i]))
+			return (0);
+	}
+	return (1);
+}
+
+/*
+ * Is someone holding a lease on the entry?  The lock we take to find
+ * out is dropped when fd is closed.
+ */
+static int
+leased(fd)
+	int fd;
+{
+#ifdef HAVE_FLOCK
+	if (fd != -1 && flock(fd, LOCK_EX|LOCK_NB) == -1 &&
+	    errno == EWOULDBLOCK)
+		return (1);
+#endif
+	return (0);
+}
+
+static int
+reap_push(r, parent, name, depth)
+	struct reaper *r;
+	struct rdir *parent;
+	const char *name;
+	int depth;
+{
+	struct rdir *d;
+	size_t len = strlen(name);
+
+	if ((d = (struct rdir *)malloc(sizeof(*d) + len)) == NULL)
+		return (-1);
+	(void)memcpy(d->name, name, len + 1);
+	d->parent = parent;
+	d->fd = -1;
+	d->users = 0;
+	d->ino = 0;
+	d->depth = depth;
+	d->pending = 1;
+	REAP_LOCK(r);
+	if (parent != NULL)
+		parent->pending++;
+	d->next = r->work;
+	r->work = d;
+#ifdef HAVE_PTHREAD
+	(void)pthread_cond_signal(&r->cond);
+#endif
+	REAP_UNLOCK(r);
+	return (0);
+}
+
+/*
+ * Done with the descriptor of d for now.  If too many directories are
+ * open it is closed as soon as nobody is using it.  Called locked.
+ */
+static void
+reap_unuse(r, d)
+	struct reaper *r;
+	struct rdir *d;
+{
+	if (--d->users == 0 && d->parent != NULL && d->fd != -1 &&
+	    r->nopen > r->maxfds) {
+		(void)close(d->fd);
+		d->fd = -1;
+		r->nopen--;
+	}
+}
+
+/*
+ * Open d, if it is not, relative to its parent (opening that again
+ * first if need be).  It must be on our file system and, if it was
+ * open before, still be the same directory.  Called locked.
+ */
+static int
+reap_open(r, d)
+	struct reaper *r;
+	struct rdir *d;
+{
+	struct stat sb;
+	int fd;
+
+	if (d->fd != -1)
+		return (0);
+	if (reap_open(r, d->parent) != 0)
+		return (-1);
+	d->parent->users++;
+	fd = openat(d->parent->fd, d->name,
+	    O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	reap_unuse(r, d->parent);
+	if (fd == -1)
+		return (-1);
+	if (fstat(fd, &sb) != 0 || sb.st_dev != r->dev ||
+	    (d->ino != 0 && sb.st_ino != d->ino)) {
+		(void)close(fd);
+		return (-1);
+	}
+	d->ino = sb.st_ino;
+	d->fd = fd;
+	r->nopen++;
+	return (0);
+}
+
+/*
+ * Get the descriptor of d, to use until reap_put().
+ */
+static int
+reap_get(r, d)
+	struct reaper *r;
+	struct rdir *d;
+{
+	int fd = -1;
+
+	REAP_LOCK(r);
+	if (reap_open(r, d) == 0) {
+		d->users++;
+		fd = d->fd;
+	}
+	REAP_UNLOCK(r);
+	return (fd);
+}
+
+static void
+reap_put(r, d)
+	struct reaper *r;
+	struct rdir *d;
+{
+	REAP_LOCK(r);
+	reap_unuse(r, d);
+	REAP_UNLOCK(r);
+}
+
+/*
+ * Drop one reference to d, removing it and then its parents for as
+ * long as that was the last one.
+ */
+static void
+reap_release(r, d, st)
+	struct reaper *r;
+	struct rdir *d;
+	struct reap_stats *st;
+{
+	struct rdir *parent;
+	int last, pfd;
+
+	for (;;) {
+		REAP_LOCK(r);
+		last = --d->pending == 0;
+		if (last && d->parent != NULL && d->fd != -1) {
+			(void)close(d->fd);
+			d->fd = -1;
+			r->nopen--;
+		}
+		REAP_UNLOCK(r);
+		if (!last || (parent = d->parent) == NULL)
+			return;
+		/*
+		 * An emptied fan-out directory may be in use again; anyone
+		 * creating in it as it goes just picks another name.
+		 */
+		if ((pfd = reap_get(r, parent)) != -1 &&
+		    unlinkat(pfd, d->name, AT_REMOVEDIR) == 0) {
+			if (d->depth == REAP_TREE)
+				st->dirs++;
+		} else if (d->depth == REAP_TREE)
+			st->errors++;
+		if (pfd != -1)
+			reap_put(r, parent);
+		free(d);
+		d = parent;
+	}
+}
+
+/*
+ * Deal with one entry in the directory the entries are in: remove it
+ * if it is stale and nobody holds a lease on it.
+ */
+static void
+reap_entry(r, d, name, st)
+	struct reaper *r;
+	struct rdir *d;
+	const char *name;
+	struct reap_stats *st;
+{
+	struct stat sb;
+	int fd = -1;
+
+	if (!reap_match(r, name) ||
+	    fstatat(d->fd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0 ||
+	    sb.st_mtime > r->cutoff || (r->uid != 0 && sb.st_uid != r->uid))
+		return;
+	if (S_ISDIR(sb.st_mode)) {
+		fd = openat(d->fd, name,
+		    O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+		if (leased(fd)) {
+			st->leased++;
+		} else if (reap_push(r, d, name, REAP_TREE) != 0)
+			st->errors++;
+	} else {
+		if (S_ISREG(sb.st_mode))
+			fd = openat(d->fd, name,
+			    O_RDONLY|O_NOFOLLOW|O_NONBLOCK|O_NOCTTY|O_CLOEXEC);
+		if (leased(fd))
+			st->leased++;
+		else if (unlinkat(d->fd, name, 0) == 0)
+			st->files++;
+		else
+			st->errors++;
+	}
+	if (fd != -1)
+		(void)close(fd);
+}
+
+/*
+ * Read directory d: descend into fan-out directories, look for stale
+ * entries or, inside one, remove everything.
+ */
+static void
+reap_scan(r, d, st)
+	struct reaper *r;
+	struct rdir *d;
+	struct reap_stats *st;
+{
+	struct dirent *dp;
+	struct stat sb;
+	DIR *dirp;
+	int fd, isdir;
+
+	/* Don't wander onto another file system. */
+	if (reap_get(r, d) == -1) {
+		st->errors++;
+		return;
+	}
+	if ((fd = dup(d->fd)) == -1 || (dirp = fdopendir(fd)) == NULL) {
+		if (fd != -1)
+			(void)close(fd);
+		reap_put(r, d);
+		st->errors++;
+		return;
+	}
+	while ((dp = readdir(dirp)) != NULL) {
+		if (dp->d_name[0] == '.' && (dp->d_name[1] == '\0' ||
+		    (dp->d_name[1] == '.' && dp->d_name[2] == '\0')))
+			continue;
+		if (d->depth == 0) {
+			reap_entry(r, d, dp->d_name, st);
+			continue;
+		}
+#ifdef DT_DIR
+		if (dp->d_type != DT_UNKNOWN)
+			isdir = dp->d_type == DT_DIR;
+		else
+#endif
+		if (fstatat(d->fd, dp->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0)
+			isdir = S_ISDIR(sb.st_mode);
+		else
+			continue;
+		if (d->depth > 0) {
+			/* Fan-out directories are two characters. */
+			if (isdir && strlen(dp->d_name) == 2 &&
+			    reap_push(r, d, dp->d_name, d->depth - 1) != 0)
+				st->errors++;
+		} else if (isdir) {
+			if (reap_push(r, d, dp->d_name, REAP_TREE) != 0)
+				st->errors++;
+		} else if (unlinkat(d->fd, dp->d_name, 0) == 0)
+			st->files++;
+		else
+			st->errors++;
+	}
+	(void)closedir(dirp);
+	reap_put(r, d);
+}
+
+static void *
+reap_worker(arg)
+	void *arg;
+{
+	struct reaper *r = (struct reaper *)arg;
+	struct reap_stats st;
+	struct rdir *d;
+
+	(void)memset(&st, 0, sizeof(st));
+	REAP_LOCK(r);
+	for (;;) {
+#ifdef HAVE_PTHREAD
+		while (r->work == NULL && r->busy != 0)
+			(void)pthread_cond_wait(&r->cond, &r->lock);
+#endif
+		if ((d = r->work) == NULL)
+			break;
+		r->work = d->next;
+		r->busy++;
+		REAP_UNLOCK(r);
+
+		reap_scan(r, d, &st);
+		reap_release(r, d, &st);
+
+		REAP_LOCK(r);
+		r->busy--;
+#ifdef HAVE_PTHREAD
+		if (r->work == NULL && r->busy == 0)
+			(void)pthread_cond_broadcast(&r->cond);
+#endif
+	}
+	r->stats.files += st.files;
+	r->stats.dirs += st.dirs;
+	r->stats.leased += st.leased;
+	r->stats.errors += st.errors;
+	REAP_UNLOCK(r);
+	return (NULL);
+}
+
+/*
+ * Remove the entries in dir that could have been made from tmpl
+ * (a single path component) with Xs from chars (or alphanumerics, if
+ * it is NULL) and were last modified age seconds ago or
+ * earlier, fanout levels of subdirectories down, using jobs threads.
+ * Only the caller's own entries are removed unless run as root.
+ * Fills in stp and returns 0, or -1 if dir could not be read.
+ */
+int
+reap(dir, tmpl, chars, fanout, age, jobs, stp)
+	const char *dir;
+	const char *tmpl;
+	const char *chars;
+	int fanout;
+	time_t age;
+	unsigned long jobs;
+	struct reap_stats *stp;
+{
+	struct reaper r;
+	struct rdir *top;
+	struct stat sb;
+	long maxfds;
+#ifdef HAVE_SYS_TIME_H
+	struct timeval start, end;
+#endif
+#ifdef HAVE_PTHREAD
+	pthread_t *tids = NULL;
+	unsigned long nthreads = 0;
+#endif
+	int serrno;
+
+	(void)memset(&r, 0, sizeof(r));
+	r.tmpl = tmpl;
+	r.tlen = strlen(tmpl);
+	r.chars = chars;
+	for (r.xoff = r.tlen; r.xoff > 0 && tmpl[r.xoff - 1] == 'X'; r.xoff--)
+		continue;
+	if (r.xoff == r.tlen) {
+		errno = EINVAL;
+		return (-1);
+	}
+	r.cutoff = time(NULL) - age;
+	r.uid = geteuid();
+
+	if ((top = (struct rdir *)malloc(sizeof(*top))) == NULL)
+		return (-1);
+	top->parent = top->next = NULL;
+	top->name[0] = '\0';
+	top->depth = fanout;
+	top->pending = 1;
+	top->users = 0;
+	top->fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (top->fd == -1 || fstat(top->fd, &sb) != 0) {
+		serrno = errno;
+		if (top->fd != -1)
+			(void)close(top->fd);
+		free(top);
+		errno = serrno;
+		return (-1);
+	}
+	r.dev = sb.st_dev;
+	top->ino = sb.st_ino;
+	r.work = top;
+
+	/* Leave most descriptors to whoever else needs them. */
+	r.maxfds = REAP_FDS;
+	if ((maxfds = sysconf(_SC_OPEN_MAX)) > 0 && maxfds / 4 < r.maxfds)
+		r.maxfds = maxfds / 4;
+
+#ifdef HAVE_SYS_TIME_H
+	(void)gettimeofday(&start, NULL);
+#endif
+#ifdef HAVE_PTHREAD
+	(void)pthread_mutex_init(&r.lock, NULL);
+	(void)pthread_cond_init(&r.cond, NULL);
+	if (jobs > 1 &&
+	    (tids = (pthread_t *)calloc(jobs, sizeof(*tids))) != NULL) {
+		/* The main thread is one of the jobs. */
+		for (nthreads = 1; nthreads < jobs; nthreads++) {
+			if (pthread_create(&tids[nthreads], NULL, reap_worker,
+			    &r) != 0)
+				break;
+		}
+	}
+#endif
+	(void)reap_worker(&r);
+#ifdef HAVE_PTHREAD
+	while (nthreads > 1)
+		(void)pthread_join(tids[--nthreads], NULL);
+	free(tids);
+	(void)pthread_mutex_destroy(&r.lock);
+	(void)pthread_cond_destroy(&r.cond);
+#endif
+#ifdef HAVE_SYS_TIME_H
+	(void)gettimeofday(&end, NULL);
+	r.stats.usecs = (end.tv_sec - start.tv_sec) * 1000000.0 +
+	    (end.tv_usec - start.tv_usec);
+#endif
+
+	(void)close(top->fd);
+	free(top);
+	*stp = r.stats;
+	return (0);
+}
+
+#else /* HAVE_OPENAT && HAVE_FDOPENDIR && HAVE_UNLINKAT && HAVE_FSTATAT */
+
+int
+reap(dir, tmpl, chars, fanout, age, jobs, stp)
+	const char *dir;
+	const char *tmpl;
+	const char *chars;
+	int fanout;
+	time_t age;
+	unsigned long jobs;
+	struct reap_stats *stp;
+{
+	errno = EOPNOTSUPP;
+	return (-1);
+}
+
+#endif /* HAVE_OPENAT && HAVE_FDOPENDIR && HAVE_UNLINKAT && HAVE_FSTATAT */
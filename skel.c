@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Directory skeletons: the subdirectories and empty files a new
+ * temporary directory is to be populated with.  A skeleton is parsed
+ * once and sorted so that every directory comes before what goes in
+ * it.  Building one then only ever looks up a single component,
+ * relative to a descriptor held on its parent since that was made.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif /* HAVE_STRINGS_H */
+#endif /* HAVE_STRING_H */
+#include <ctype.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <extern.h>
+
+#ifndef O_CLOEXEC
+# define O_CLOEXEC	0
+#endif
+#ifndef O_DIRECTORY
+# define O_DIRECTORY	0
+#endif
+#ifndef O_NOFOLLOW
+# define O_NOFOLLOW	0
+#endif
+#ifndef NAME_MAX
+# define NAME_MAX	255
+#endif
+
+#define SKEL_DEPTH	32	/* deepest entry, counting from 1 */
+
+struct skel_ent {
+	char *path;		/* relative to the top */
+	const char *name;	/* its last component */
+	int depth;		/* number of components */
+	int isdir;
+};
+
+struct mktemp_skel {
+	int n;
+	struct skel_ent *ents;	/* parents before their children */
+};
+
+/*
+ * Sort paths component by component, so that "a" and everything in it
+ * come before "a-b": the end of a string sorts first, then '/'.
+ */
+static int
+skel_cmp(v1, v2)
+	const void *v1;
+	const void *v2;
+{
+	const unsigned char *p = (const unsigned char *)
+	    ((const struct skel_ent *)v1)->path;
+	const unsigned char *q = (const unsigned char *)
+	    ((const struct skel_ent *)v2)->path;
+	int c1, c2;
+
+	while (*p != '\0' && *p == *q)
+		p++, q++;
+	c1 = *p == '\0' ? 0 : *p == '/' ? 1 : *p + 1;
+	c2 = *q == '\0' ? 0 : *q == '/' ? 1 : *q + 1;
+	return (c1 - c2);
+}
+
+/*
+ * Add the entry for the first len characters of path, which has
+ * already been checked.
+ */
+static int
+skel_add(skel, space, path, len, isdir)
+	struct mktemp_skel *skel;
+	int *space;
+	const char *path;
+	size_t len;
+	int isdir;
+{
+	struct skel_ent *ent;
+	const char *cp;
+
+	if (skel->n == *space) {
+		*space = *space ? *space * 2 : 32;
+		ent = (struct skel_ent *)realloc(skel->ents,
+		    *space * sizeof(*ent));
+		if (ent == NULL)
+			return (-1);
+		skel->ents = ent;
+	}
+	ent = &skel->ents[skel->n];
+	if ((ent->path = (char *)malloc(len + 1)) == NULL)
+		return (-1);
+	(void)memcpy(ent->path, path, len);
+	ent->path[len] = '\0';
+	ent->isdir = isdir;
+	ent->depth = 1;
+	for (cp = ent->path; *cp != '\0'; cp++) {
+		if (*cp == '/')
+			ent->depth++;
+	}
+	skel->n++;
+	return (0);
+}
+
+/*
+ * Add one entry of a spec and the directories it is in.  A trailing
+ * slash makes it a directory.
+ */
+static int
+skel_entry(skel, space, path, len)
+	struct mktemp_skel *skel;
+	int *space;
+	const char *path;
+	size_t len;
+{
+	size_t i, clen;
+	int isdir = 0, depth = 0;
+
+	if (len != 0 && path[len - 1] == '/') {
+		isdir = 1;
+		len--;
+	}
+	if (len == 0 || path[0] == '/') {
+		errno = EINVAL;
+		return (-1);
+	}
+	for (i = 0; i <= len; i += clen + 1) {
+		for (clen = 0; i + clen < len && path[i + clen] != '/'; clen++)
+			continue;
+		if (clen == 0 || clen > NAME_MAX || ++depth > SKEL_DEPTH ||
+		    (path[i] == '.' && (clen == 1 ||
+		    (clen == 2 && path[i + 1] == '.')))) {
+			errno = clen > NAME_MAX ? ENAMETOOLONG : EINVAL;
+			return (-1);
+		}
+		if (skel_add(skel, space, path, i + clen,
+		    i + clen < len || isdir) != 0)
+			return (-1);
+	}
+	return (0);
+}
+
+struct mktemp_skel *
+mktemp_skel_parse(spec, sep)
+	const char *spec;
+	int sep;
+{
+	struct mktemp_skel *skel;
+	const char *cp, *ep, *bp, *np;
+	int i, j, space = 0, serrno;
+
+	if ((skel = (struct mktemp_skel *)calloc(1, sizeof(*skel))) == NULL)
+		return (NULL);
+	for (cp = spec; *cp != '\0'; cp = *ep != '\0' ? ep + 1 : ep) {
+		if ((ep = strchr(cp, sep)) == NULL)
+			ep = cp + strlen(cp);
+		bp = cp;
+		np = ep;
+		/* Lines of a file may be indented and commented. */
+		if (sep == '\n') {
+			while (bp < np && isspace((unsigned char)*bp))
+				bp++;
+			while (np > bp && isspace((unsigned char)np[-1]))
+				np--;
+			if (bp != np && *bp == '#')
+				continue;
+		}
+		if (bp != np &&
+		    skel_entry(skel, &space, bp, (size_t)(np - bp)) != 0)
+			goto bad;
+	}
+
+	/* Sort, then merge duplicates; a file cannot also be a directory. */
+	if (skel->n != 0)
+		qsort(skel->ents, skel->n, sizeof(*skel->ents), skel_cmp);
+	for (i = 0, j = 0; i < skel->n; i++) {
+		if (j != 0 && strcmp(skel->ents[j - 1].path,
+		    skel->ents[i].path) == 0) {
+			if (skel->ents[j - 1].isdir != skel->ents[i].isdir) {
+				errno = EINVAL;
+				goto bad;
+			}
+			free(skel->ents[i].path);
+			skel->ents[i].path = NULL;
+			continue;
+		}
+		if (i != j) {
+			skel->ents[j] = skel->ents[i];
+			skel->ents[i].path = NULL;
+		}
+		j++;
+	}
+	skel->n = j;
+	for (i = 0; i < skel->n; i++) {
+		cp = strrchr(skel->ents[i].path, '/');
+		skel->ents[i].name = cp ? cp + 1 : skel->ents[i].path;
+	}
+	return (skel);
+
+bad:
+	serrno = errno;
+	mktemp_skel_free(skel);
+	errno = serrno;
+	return (NULL);
+}
+
+void
+mktemp_skel_free(skel)
+	struct mktemp_skel *skel;
+{
+	int i;
+
+	if (skel == NULL)
+		return;
+	for (i = 0; i < skel->n; i++)
+		free(skel->ents[i].path);
+	free(skel->ents);
+	free(skel);
+}
+
+int
+mktemp_skel_build(dfd, skel)
+	int dfd;
+	const struct mktemp_skel *skel;
+{
+#if defined(HAVE_OPENAT) && defined(HAVE_MKDIRAT)
+	const struct skel_ent *ent;
+	int fds[SKEL_DEPTH], top = 0, i, fd, serrno;
+
+	/* fds[d] is the directory the entries of depth d + 1 go in. */
+	fds[0] = dfd;
+	for (i = 0; i < skel->n; i++) {
+		ent = &skel->ents[i];
+		while (top >= ent->depth)
+			(void)close(fds[top--]);
+		if (ent->isdir) {
+			if (mkdirat(fds[top], ent->name, 0777) != 0)
+				goto bad;
+			/* Only hold on to it if something goes in it. */
+			if (i + 1 == skel->n ||
+			    skel->ents[i + 1].depth <= ent->depth)
+				continue;
+			if ((fd = openat(fds[top], ent->name,
+			    O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC)) == -1)
+				goto bad;
+			fds[++top] = fd;
+		} else {
+			if ((fd = openat(fds[top], ent->name,
+			    O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC,
+			    0666)) == -1)
+				goto bad;
+			(void)close(fd);
+		}
+	}
+	while (top > 0)
+		(void)close(fds[top--]);
+	return (skel->n);
+
+bad:
+	serrno = errno;
+	while (top > 0)
+		(void)close(fds[top--]);
+	errno = serrno;
+	return (-1);
+#else
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
+
+/*
+ * Remove what was built of a skeleton in dfd after a failure, deepest
+ * entries first.  Entries that were never made are simply skipped.
+ */
+void
+skel_remove(dfd, skel)
+	int dfd;
+	const struct mktemp_skel *skel;
+{
+#ifdef HAVE_UNLINKAT
+	int i;
+
+	for (i = skel->n - 1; i >= 0; i--)
+		(void)unlinkat(dfd, skel->ents[i].path,
+		    skel->ents[i].isdir ? AT_REMOVEDIR : 0);
+#endif
+}
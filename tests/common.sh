@@ -0,0 +1,54 @@
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# Shared by the tests, which source it: a scratch directory $T that is
+# removed again on exit, and helpers to fail or skip a test.
+#
+
+: ${MKTEMP:?MKTEMP must name the mktemp to test}
+
+T=${TMPDIR:-/tmp}/mktemp-test.$$
+rm -rf "$T"
+mkdir -m 700 "$T" || exit 1
+trap 'chmod -R u+rwx "$T" 2>/dev/null; rm -rf "$T"' 0
+trap 'exit 1' 1 2 15
+
+fail() {
+    echo "`basename $0 .sh`: $*" 1>&2
+    exit 1
+}
+
+skip() {
+    echo "`basename $0 .sh`: skipped, $*" 1>&2
+    exit 77
+}
+
+# The features built on mktemp's own engine are missing with --with-libc.
+need_engine() {
+    $MKTEMP -q -d -k probe/ -p "$T" probe.XXXXXX >/dev/null 2>&1 ||
+	skip "needs mktemp's own engine"
+    rm -rf "$T"/probe.*
+}
+
+# Run a command as some other, unprivileged user; only root can.
+as_nobody() {
+    if command -v runuser >/dev/null 2>&1; then
+	runuser -u nobody -- "$@"
+    elif command -v setpriv >/dev/null 2>&1; then
+	setpriv --reuid=nobody --regid=nogroup --clear-groups -- "$@"
+    else
+	return 127
+    fi
+}
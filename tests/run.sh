@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# Run the regression tests, each tests/t-*.sh script, against a mktemp
+# binary and report how they fared.  A test exits 0 if it passed, 77 if
+# it does not apply to this build or system, and anything else if it
+# failed.
+#
+# Usage: run.sh mktemp [test ...]
+#
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 mktemp [test ...]" 1>&2
+    exit 1
+fi
+case $1 in
+    /*)	MKTEMP=$1;;
+    *)	MKTEMP=`pwd`/$1;;
+esac
+shift
+TESTDIR=`dirname $0`
+export MKTEMP TESTDIR
+
+[ $# -eq 0 ] && set -- "$TESTDIR"/t-*.sh
+pass=0 skip=0 fail=0
+for t in "$@"; do
+    name=`basename $t .sh`
+    sh "$t"
+    case $? in
+	0)  echo "PASS: $name"; pass=`expr $pass + 1`;;
+	77) echo "SKIP: $name"; skip=`expr $skip + 1`;;
+	*)  echo "FAIL: $name"; fail=`expr $fail + 1`;;
+    esac
+done
+echo "$pass passed, $skip skipped, $fail failed"
+[ $fail -eq 0 ]
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# mktemp -A draws the suffix from the alphabet given, and gives up
+# cleanly once every name the template allows is taken.
+#
+
+. "`dirname $0`/common.sh"
+need_engine
+
+# only alphabet pattern: the names made must match pattern
+only() {
+    $MKTEMP -A "$1" -n 20 -p "$T" a.XXXXXXXX > "$T/names" ||
+	fail "mktemp -A $1 failed"
+    while read e; do
+	case `basename "$e"` in
+	    a.$2$2$2$2$2$2$2$2) ;;
+	    *)	fail "$e uses characters not in $1";;
+	esac
+	[ -f "$e" ] || fail "$e was not created"
+    done < "$T/names"
+    rm -f "$T"/a.*
+}
+
+only hex '[0-9a-f]'
+only base32 '[a-z2-7]'
+only base64url '[A-Za-z0-9_-]'
+only xyz '[xyz]'
+
+for a in x xx a/b; do
+    $MKTEMP -q -A "$a" -p "$T" a.XXXX >/dev/null 2>&1 &&
+	fail "accepted the alphabet $a"
+done
+rm -f "$T/names"
+[ -z "`ls -A $T`" ] || fail "a bad alphabet still created something"
+
+# A two-character hex suffix has room for exactly 256 names.
+$MKTEMP -i -A hex -n 256 -p "$T" x.XX > /dev/null ||
+    fail "could not make all 256 names"
+[ `ls "$T" | grep -c '^x\.[0-9a-f][0-9a-f]$'` -eq 256 ] ||
+    fail "did not make 256 distinct names"
+$MKTEMP -i -A hex -p "$T" x.XX > "$T/out" 2> "$T/err"
+[ $? -eq 1 ] || fail "did not fail with every name taken"
+[ -s "$T/out" ] && fail "printed a name with every name taken"
+grep 'File exists' "$T/err" >/dev/null ||
+    fail "did not report the name space as exhausted: `cat $T/err`"
+exit 0
@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# mktemp -e removes the entry once the command is done with it, whether
+# the command exits, is killed, or mktemp itself is sent a signal.
+#
+
+. "`dirname $0`/common.sh"
+
+# Name of the entry the last command was run on.
+entry() {
+    [ -s "$T/name" ] || fail "the command was not run"
+    cat "$T/name"
+}
+
+$MKTEMP -e -p "$T" x.XXXXXX -- sh -c "echo {} > $T/name; exit 3"
+[ $? -eq 3 ] || fail "the command's exit status was not passed on"
+e=`entry`
+case $e in
+    "$T"/x.??????) ;;
+    *)	fail "ran the command on $e";;
+esac
+[ -e "$e" ] && fail "$e was left behind after a normal exit"
+
+rm -f "$T/name"
+$MKTEMP -d -e -p "$T" x.XXXXXX -- \
+    sh -c "echo {} > $T/name; mkdir {}/sub; echo x > {}/sub/file"
+[ $? -eq 0 ] || fail "mktemp -d -e failed"
+e=`entry`
+[ -e "$e" ] && fail "directory $e was left behind"
+
+rm -f "$T/name"
+$MKTEMP -e -p "$T" x.XXXXXX -- sh -c "echo {} > $T/name; kill -9 \$\$"
+[ $? -eq 0 ] && fail "a killed command looked successful"
+e=`entry`
+[ -e "$e" ] && fail "$e was left behind when the command was killed"
+
+# Signals sent to mktemp are passed on and it still cleans up.
+rm -f "$T/name"
+$MKTEMP -e -p "$T" x.XXXXXX -- sh -c "echo {} > $T/name; exec sleep 30" &
+pid=$!
+n=0
+while [ ! -s "$T/name" ] && [ $n -lt 50 ]; do
+    sleep 1
+    n=`expr $n + 1`
+done
+kill -TERM $pid
+wait $pid 2>/dev/null
+[ $? -eq 0 ] && fail "mktemp exited 0 after being terminated"
+e=`entry`
+[ -e "$e" ] && fail "$e was left behind when mktemp was terminated"
+
+# An anonymous file (-a) need not be given a name at all.
+$MKTEMP -a -e -p "$T" x.XXXXXX -- sh -c "echo data > {} && cat {}" \
+    > "$T/out" || fail "mktemp -a -e failed"
+[ "`cat $T/out`" = data ] || fail "the command could not use its -a file"
+ls "$T" | grep '^x\.' >/dev/null && fail "a -a file was left behind"
+exit 0
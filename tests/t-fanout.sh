@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# mktemp -F puts entries in private subdirectories named after their
+# suffix, and steers clear of fan-out directories it cannot trust.
+#
+
+. "`dirname $0`/common.sh"
+need_engine
+
+$MKTEMP -F 2 -n 20 -p "$T" t.XXXXXXXX > "$T/names" || fail "mktemp -F 2 failed"
+[ `wc -l < "$T/names"` -eq 20 ] || fail "did not make 20 entries"
+while read e; do
+    case $e in
+	"$T"/??/??/t.????????) ;;
+	*)	fail "$e is not two levels down";;
+    esac
+    [ -f "$e" ] || fail "$e was not created"
+    s=`basename "$e" | sed 's/^t\.//'`
+    d=`dirname "$e"`
+    [ "`basename $d`" = "`echo $s | cut -c3-4`" ] &&
+	[ "`basename \`dirname $d\``" = "`echo $s | cut -c1-2`" ] ||
+	fail "$e is not filed under its suffix"
+    for p in "$d" "`dirname $d`"; do
+	[ "`ls -ld $p | cut -c1-10`" = drwx------ ] ||
+	    fail "$p is not mode 0700"
+    done
+done < "$T/names"
+
+# Leave a single usable fan-out directory; every other one is a symbolic
+# link to a victim directory or, as root, a directory others may write.
+mkdir "$T/fan" "$T/victim" || exit 1
+hex="0 1 2 3 4 5 6 7 8 9 a b c d e f"
+for a in $hex; do
+    for b in $hex; do
+	ln -s ../victim "$T/fan/$a$b"
+    done
+done
+rm "$T/fan/5a" "$T/fan/c3"
+mkdir "$T/fan/5a"
+if [ "`id -u`" -eq 0 ]; then
+    mkdir -m 777 "$T/fan/c3" && chown nobody "$T/fan/c3" || exit 1
+else
+    ln -s ../victim "$T/fan/c3"
+fi
+$MKTEMP -A hex -F 1 -n 5 -p "$T/fan" t.XXXX > "$T/names" ||
+    fail "mktemp -F 1 failed with one usable directory"
+while read e; do
+    case $e in
+	"$T"/fan/5a/t.5a??) ;;
+	*)	fail "$e was put in an untrusted directory";;
+    esac
+done < "$T/names"
+[ -z "`ls -A $T/victim`" ] || fail "entries were created through a link"
+[ -z "`ls -A $T/fan/c3`" ] ||
+    fail "entries were created in a foreign directory"
+
+# In a shared directory like /tmp, every user fans out into the same
+# levels, whoever made them.
+[ "`id -u`" -eq 0 ] || exit 0
+chmod 755 "$T" && mkdir -m 1777 "$T/shared" || exit 1
+(umask 077; $MKTEMP -A hex -F 1 -n 1000 -p "$T/shared" XXXX) > /dev/null ||
+    fail "mktemp -F 1 failed in a shared directory"
+for d in "$T"/shared/*; do
+    [ "`ls -ld $d | cut -c1-10`" = drwxrwxrwt ] ||
+	fail "shared level $d is not mode 1777"
+done
+as_nobody $MKTEMP -A hex -F 1 -n 100 -p "$T/shared" XXXX > "$T/names"
+case $? in
+    0)	;;
+    127) skip "cannot run mktemp as another user";;
+    *)	fail "another user could not fan out where root already had";;
+esac
+n=0
+while read e; do
+    [ "`ls -ld \`dirname $e\` | awk '{print $3}'`" = root ] && n=`expr $n + 1`
+done < "$T/names"
+[ $n -gt 0 ] || fail "no entry of the other user went in a level of root's"
+exit 0
@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# mktemp -r only removes stale entries matching the template, never
+# follows a symbolic link out of the tree, and leaves other users'
+# entries alone.
+#
+
+. "`dirname $0`/common.sh"
+
+old() {
+    touch -h -t 200001010000 "$@" || fail "cannot backdate $*"
+}
+
+D=$T/d
+mkdir "$D" "$T/victim"
+echo keep > "$T/victim/keep"
+old "$T/victim/keep" "$T/victim"
+
+echo x > "$D/t.aaaaaa"
+mkdir "$D/t.bbbbbb"
+echo x > "$D/t.bbbbbb/file"
+ln -s "$T/victim" "$D/t.bbbbbb/link"
+ln -s "$T/victim" "$D/t.cccccc"
+echo x > "$D/t.dddddd"
+echo x > "$D/u.aaaaaa"
+echo x > "$D/t.aaa"
+old "$D/t.aaaaaa" "$D/t.bbbbbb/file" "$D/t.bbbbbb/link" "$D/t.bbbbbb" \
+    "$D/t.cccccc" "$D/u.aaaaaa" "$D/t.aaa"
+
+$MKTEMP -q -r 1d -p "$D" t.XXXXXX >/dev/null || fail "mktemp -r failed"
+for f in t.aaaaaa t.bbbbbb; do
+    [ -e "$D/$f" ] && fail "stale $f was not removed"
+done
+[ -e "$D/t.dddddd" ] || fail "fresh t.dddddd was removed"
+[ -e "$D/u.aaaaaa" ] || fail "u.aaaaaa does not match the template"
+[ -e "$D/t.aaa" ] || fail "t.aaa has too few Xs to match the template"
+[ -f "$T/victim/keep" ] || fail "removed a file through a symbolic link"
+
+# A tree deeper than there are descriptors to hold it open.
+p=$D/t.gggggg
+i=0
+while [ $i -lt 150 ]; do
+    p=$p/d
+    i=`expr $i + 1`
+done
+mkdir -p "$p" && echo x > "$p/file" || exit 1
+old "$D/t.gggggg"
+(ulimit -n 20; $MKTEMP -q -r 1d -j 4 -p "$D" t.XXXXXX) >/dev/null ||
+    fail "mktemp -r failed on a deep tree"
+[ -e "$D/t.gggggg" ] && fail "a deep tree was not removed"
+
+# Only root can act as somebody else.
+[ `id -u` -eq 0 ] || skip "ownership not tested when not run by root"
+chmod 755 "$T"
+chown nobody "$D"
+echo x > "$D/t.eeeeee"
+echo x > "$D/t.ffffff"
+chown nobody "$D/t.ffffff"
+old "$D/t.eeeeee" "$D/t.ffffff"
+as_nobody $MKTEMP -q -r 1d -p "$D" t.XXXXXX >/dev/null
+case $? in
+    0)	;;
+    127) skip "no way to run a command as nobody";;
+    *)	fail "mktemp -r failed as nobody";;
+esac
+[ -e "$D/t.ffffff" ] && fail "nobody's stale t.ffffff was not removed"
+[ -e "$D/t.eeeeee" ] || fail "nobody removed root's t.eeeeee"
+exit 0
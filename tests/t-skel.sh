@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+#
+# mktemp -d -k builds the skeleton in each new directory, and leaves
+# nothing behind when it cannot.
+#
+
+. "`dirname $0`/common.sh"
+need_engine
+
+# tree dir: list what is in dir, directories marked with a slash
+tree() {
+    (cd "$1" && find . -mindepth 1 \( -type d -exec echo {}/ \; \) -o -print |
+	sed 's|^\./||' | sort | tr '\n' ' ')
+}
+
+want="a/ a/b c/ c/d/ "
+d=`$MKTEMP -d -k a/,a/b,c/d/ -p "$T" s.XXXXXX` || fail "mktemp -k failed"
+[ "`tree $d`" = "$want" ] || fail "built `tree $d` rather than $want"
+[ -f "$d/a/b" ] || fail "a/b is not a plain file"
+
+cat > "$T/spec" <<EOS
+# a comment
+  a/b
+c/d/
+a/
+EOS
+d=`$MKTEMP -d -k @"$T/spec" -p "$T" s.XXXXXX` || fail "mktemp -k @file failed"
+[ "`tree $d`" = "$want" ] || fail "built `tree $d` from a file"
+d=`$MKTEMP -d -k @- -p "$T" s.XXXXXX < "$T/spec"` ||
+    fail "mktemp -k @- failed"
+[ "`tree $d`" = "$want" ] || fail "built `tree $d` from the standard input"
+rm -rf "$T"/s.* "$T/spec"
+
+for k in /a ../a a/../b a,a/; do
+    $MKTEMP -q -d -k "$k" -p "$T" s.XXXXXX >/dev/null 2>&1 &&
+	fail "accepted the skeleton $k"
+done
+
+# Running out of descriptors part way down a deep skeleton must undo
+# all of it, including the hidden directory it was built in.
+(ulimit -n 6; $MKTEMP -q -d -k a/b/c/d/e/f/g/h/i/j/k/ -p "$T" s.XXXXXX) \
+    >/dev/null 2>&1 && skip "could not make the build run out of descriptors"
+[ -z "`ls -A $T`" ] || fail "left `ls -A $T` behind after failing"
+exit 0
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2026 Todd C. Miller <Todd.Miller@courtesan.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Just enough of an io_uring to submit a batch of creations and
+ * collect the results, using the system calls directly rather than
+ * depending on liburing.  The submission and completion rings are
+ * shared with the kernel, hence the acquire/release accesses to
+ * their heads and tails.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#ifdef HAVE_IO_URING
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#endif
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#ifdef HAVE_STRING_H
+# include <string.h>
+#else
+# ifdef HAVE_STRINGS_H
+#  include <strings.h>
+# endif /* HAVE_STRINGS_H */
+#endif /* HAVE_STRING_H */
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <extern.h>
+
+#ifdef HAVE_IO_URING
+
+#define RING_ADDR(base, off)	((void *)((char *)(base) + (off)))
+#define LOAD_ACQ(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v)		__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*
+ * Set up a ring with room for at least entries submissions.
+ */
+int
+uring_open(ring, entries)
+	struct uring *ring;
+	unsigned int entries;
+{
+	struct io_uring_params p;
+	int serrno;
+
+	(void)memset(ring, 0, sizeof(*ring));
+	(void)memset(&p, 0, sizeof(p));
+	ring->sq_ring = ring->cq_ring = ring->sqes = MAP_FAILED;
+	if ((ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p)) == -1)
+		return (-1);
+
+	ring->sq_ring_size = p.sq_off.array +
+	    p.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = 0;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		goto bad;
+	if (ring->cq_ring_size == 0)
+		ring->cq_ring = ring->sq_ring;
+	else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+		    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd,
+		    IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+			goto bad;
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto bad;
+
+	ring->sq_head = RING_ADDR(ring->sq_ring, p.sq_off.head);
+	ring->sq_tail = RING_ADDR(ring->sq_ring, p.sq_off.tail);
+	ring->sq_mask = RING_ADDR(ring->sq_ring, p.sq_off.ring_mask);
+	ring->sq_array = RING_ADDR(ring->sq_ring, p.sq_off.array);
+	ring->cq_head = RING_ADDR(ring->cq_ring, p.cq_off.head);
+	ring->cq_tail = RING_ADDR(ring->cq_ring, p.cq_off.tail);
+	ring->cq_mask = RING_ADDR(ring->cq_ring, p.cq_off.ring_mask);
+	ring->cqes = RING_ADDR(ring->cq_ring, p.cq_off.cqes);
+	ring->entries = p.sq_entries;
+	return (0);
+
+bad:
+	serrno = errno;
+	uring_close(ring);
+	errno = serrno;
+	return (-1);
+}
+
+void
+uring_close(ring)
+	struct uring *ring;
+{
+	if (ring->sqes != MAP_FAILED)
+		(void)munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		(void)munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring != MAP_FAILED)
+		(void)munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd != -1)
+		(void)close(ring->fd);
+	ring->fd = -1;
+}
+
+/*
+ * Get the next free submission entry, cleared, or NULL if the queue
+ * is full.  It is only handed to the kernel by uring_submit().
+ */
+struct io_uring_sqe *
+uring_sqe(ring)
+	struct uring *ring;
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *ring->sq_tail + ring->queued;
+
+	if (tail - LOAD_ACQ(ring->sq_head) >= ring->entries)
+		return (NULL);
+	sqe = (struct io_uring_sqe *)ring->sqes + (tail & *ring->sq_mask);
+	(void)memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+	ring->queued++;
+	return (sqe);
+}
+
+/*
+ * Submit what has been queued and wait until at least wait results
+ * are ready, in a single system call.
+ */
+int
+uring_submit(ring, wait)
+	struct uring *ring;
+	unsigned int wait;
+{
+	unsigned int n = ring->queued;
+	int rval;
+
+	STORE_REL(ring->sq_tail, *ring->sq_tail + n);
+	ring->queued = 0;
+	do {
+		rval = (int)syscall(__NR_io_uring_enter, ring->fd, n, wait,
+		    wait ? IORING_ENTER_GETEVENTS : 0, NULL, _NSIG / 8);
+		if (rval > 0)
+			n -= rval;
+	} while ((rval == -1 && errno == EINTR) || (rval > 0 && n != 0));
+	return (rval == -1 ? -1 : 0);
+}
+
+/*
+ * Take back the last entry uring_submit() handed over, provided the
+ * kernel has not taken it yet, as after uring_submit() failed part
+ * way.  The kernel only reads the queue within io_uring_enter(), so
+ * nothing races with us.  Returns NULL once there is nothing left.
+ */
+struct io_uring_sqe *
+uring_unsubmit(ring)
+	struct uring *ring;
+{
+	unsigned int tail = *ring->sq_tail;
+
+	if (tail == LOAD_ACQ(ring->sq_head))
+		return (NULL);
+	tail--;
+	STORE_REL(ring->sq_tail, tail);
+	return ((struct io_uring_sqe *)ring->sqes +
+	    ring->sq_array[tail & *ring->sq_mask]);
+}
+
+/*
+ * Take the next result, if there is one.
+ */
+int
+uring_result(ring, datap, resp)
+	struct uring *ring;
+	unsigned long long *datap;
+	int *resp;
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head = *ring->cq_head;
+
+	if (head == LOAD_ACQ(ring->cq_tail))
+		return (0);
+	cqe = (struct io_uring_cqe *)ring->cqes + (head & *ring->cq_mask);
+	*datap = cqe->user_data;
+	*resp = cqe->res;
+	STORE_REL(ring->cq_head, head + 1);
+	return (1);
+}
+
+#else /* HAVE_IO_URING */
+
+int
+uring_open(ring, entries)
+	struct uring *ring;
+	unsigned int entries;
+{
+	ring->fd = -1;
+	errno = ENOSYS;
+	return (-1);
+}
+
+void
+uring_close(ring)
+	struct uring *ring;
+{
+}
+
+#endif /* HAVE_IO_URING */